@@ -35,3 +35,4 @@ LOCAL_C_INCLUDES += \
 
 include $(BUILD_SHARED_LIBRARY)
 
+include $(call all-makefiles-under,$(LOCAL_PATH))
@@ -19,10 +19,13 @@
 
 #include <errno.h>
 #include <malloc.h>
+#include <math.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <sys/time.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include <cutils/log.h>
 #include <cutils/str_parms.h>
@@ -43,22 +46,158 @@
 #include <sys/ioctl.h>
 #include <linux/audio_hifi.h>
 
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define CARD_OUT 0
 #define PORT_CODEC 0
 /* Minimum granularity - Arbitrary but small value */
 #define CODEC_BASE_FRAME_COUNT 32
 
-/* number of base blocks in a short period (low latency) */
+/* number of base blocks in a period of the primary output */
 #define PERIOD_MULTIPLIER 32  /* 21 ms */
-/* number of frames per short period (low latency) */
+/* number of frames per period of the primary output */
 #define PERIOD_SIZE (CODEC_BASE_FRAME_COUNT * PERIOD_MULTIPLIER)
-/* number of pseudo periods for low latency playback */
+/* number of periods for primary playback */
 #define PLAYBACK_PERIOD_COUNT 4
 #define PLAYBACK_PERIOD_START_THRESHOLD 2
+
+/* number of base blocks in a short period (low latency) */
+#define LOW_LATENCY_PERIOD_MULTIPLIER 8  /* 5.3 ms */
+/* number of frames per short period (low latency) */
+#define LOW_LATENCY_PERIOD_SIZE (CODEC_BASE_FRAME_COUNT * LOW_LATENCY_PERIOD_MULTIPLIER)
+/* number of pseudo periods for low latency playback */
+#define LOW_LATENCY_PERIOD_COUNT 4
+#define LOW_LATENCY_PERIOD_START_THRESHOLD 2
+
+/* number of base blocks in a long period (deep buffer) */
+#define DEEP_BUFFER_PERIOD_MULTIPLIER 60  /* 40 ms */
+/* number of frames per long period (deep buffer) */
+#define DEEP_BUFFER_PERIOD_SIZE (CODEC_BASE_FRAME_COUNT * DEEP_BUFFER_PERIOD_MULTIPLIER)
+/* number of periods for deep buffer playback */
+#define DEEP_BUFFER_PERIOD_COUNT 8
+#define DEEP_BUFFER_PERIOD_START_THRESHOLD 2
+
 #define CODEC_SAMPLING_RATE 48000
 #define CHANNEL_STEREO 2
 #define MIN_WRITE_SLEEP_US      5000
 
+#define NSEC_PER_MSEC 1000000LL
+#define NSEC_PER_SEC  1000000000LL
+
+/* The gain of the firmware PCM_GAIN stage is not published anywhere. The software
+ * fallback uses the audio_hal.sw_gain_db property if it is set, or else the gain measured
+ * by sending the DSP a constant buffer of DSP_GAIN_PROBE_LEVEL when the device is opened.
+ * The probe sees a flat gain only: any frequency shaping in the firmware is not mirrored.
+ */
+#define DSP_GAIN_PROBE_LEVEL 4096  /* -18 dBFS, leaves room for up to +18 dB */
+#define DSP_GAIN_PROBE_SAMPLES 256
+#define DSP_GAIN_PROBE_TIMEOUT_NS (100 * NSEC_PER_MSEC)
+#define SW_GAIN_Q 14
+#define SW_GAIN_UNITY (1 << SW_GAIN_Q)
+/* the DSP may take up to 1/DSP_LATENCY_BUDGET_DIVIDER of a period per buffer */
+#define DSP_LATENCY_BUDGET_DIVIDER 2
+/* how long to process on the CPU after the DSP failed, was too slow or did not answer
+ * within a period
+ */
+#define DSP_BYPASS_BACKOFF_NS (1000 * NSEC_PER_MSEC)
+
+enum output_profile_id {
+    OUT_PROFILE_PRIMARY,
+    OUT_PROFILE_LOW_LATENCY,
+    OUT_PROFILE_DEEP_BUFFER,
+    OUT_PROFILE_CNT
+};
+
+/* PCM period layout of an output. The defaults below can be overridden at
+ * runtime through the audio_hal.<tag>.period_size, audio_hal.<tag>.period_count
+ * and audio_hal.<tag>.start_threshold properties; they are read every time an
+ * output stream is opened.
+ *
+ * The codec has a single playback PCM, so only one output is advertised to the
+ * policy. It keeps the primary period layout unless audio_hal.output_profile is
+ * set to the tag of another profile.
+ */
+struct output_profile {
+    const char *name;
+    const char *tag;
+    unsigned int period_size;       /* frames */
+    unsigned int period_count;
+    unsigned int start_threshold;   /* periods */
+};
+
+static const struct output_profile default_output_profiles[OUT_PROFILE_CNT] = {
+    [OUT_PROFILE_PRIMARY] = {
+        .name = "primary",
+        .tag = "primary",
+        .period_size = PERIOD_SIZE,
+        .period_count = PLAYBACK_PERIOD_COUNT,
+        .start_threshold = PLAYBACK_PERIOD_START_THRESHOLD,
+    },
+    [OUT_PROFILE_LOW_LATENCY] = {
+        .name = "low_latency",
+        .tag = "ll",
+        .period_size = LOW_LATENCY_PERIOD_SIZE,
+        .period_count = LOW_LATENCY_PERIOD_COUNT,
+        .start_threshold = LOW_LATENCY_PERIOD_START_THRESHOLD,
+    },
+    [OUT_PROFILE_DEEP_BUFFER] = {
+        .name = "deep_buffer",
+        .tag = "db",
+        .period_size = DEEP_BUFFER_PERIOD_SIZE,
+        .period_count = DEEP_BUFFER_PERIOD_COUNT,
+        .start_threshold = DEEP_BUFFER_PERIOD_START_THRESHOLD,
+    },
+};
+
+/* Per stream counters, reported by out_dump() */
+struct output_stats {
+    uint64_t writes;        /* out_write() calls, i.e. writer thread wakeups */
+    uint64_t frames;
+    unsigned int starts;    /* standby exits */
+    int64_t active_ns;
+    int64_t standby_ns;
+    struct timespec last_transition;
+};
+
+/* Per stream choice between HIFI_MISC_IOCTL_PCM_GAIN and the software gain */
+struct dsp_select {
+    int16_t sw_gain;            /* Q14 */
+    int64_t budget_ns;
+    int64_t timeout_ns;         /* one period: waiting longer underruns anyway */
+    int64_t latency_avg_ns;     /* moving average of PCM_GAIN round trips */
+    int64_t latency_max_ns;
+    struct timespec bypass_until;
+    uint64_t dsp_writes;
+    uint64_t cpu_writes;
+    unsigned int dsp_errors;
+    unsigned int dsp_slow;
+    unsigned int dsp_timeouts;
+    int16_t *proc_buf;
+    size_t proc_buf_size;
+};
+
+/* Runs HIFI_MISC_IOCTL_PCM_GAIN on its own thread, so that a write gives up on a DSP that
+ * does not answer instead of hanging with it. The thread is detached and owns the worker:
+ * it closes the device and frees the worker once asked to exit, which may be long after
+ * adev_close() if an ioctl is stuck.
+ */
+struct dsp_worker {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /* CLOCK_MONOTONIC */
+    int fd;
+    int16_t *buf;
+    size_t buf_size;
+    size_t bytes;           /* size of the request in buf */
+    bool queued;            /* request not picked up by the thread yet */
+    bool busy;              /* request queued, in the ioctl or not collected yet */
+    bool waiting;           /* a writer waits for the request; else the thread drops it */
+    bool done;
+    int result;
+    bool exit;
+};
+
 struct stub_stream_in {
     struct audio_stream_in stream;
 };
@@ -71,7 +210,8 @@ struct alsa_audio_device {
     struct alsa_stream_in *active_input;
     struct alsa_stream_out *active_output;
     bool mic_mute;
-    int hifi_dsp_fd;
+    struct dsp_worker *dsp_worker;  /* NULL without a DSP */
+    int16_t dsp_gain;               /* Q14, measured at open; 0 if unknown */
 };
 
 struct alsa_stream_out {
@@ -85,8 +225,374 @@ struct alsa_stream_out {
     struct alsa_audio_device *dev;
     int write_threshold;
     unsigned int written;
+    enum output_profile_id profile_id;
+    struct output_profile profile;
+    struct output_stats stats;
+    struct dsp_select dsp;
 };
 
+static int64_t timespec_diff_ns(const struct timespec *end, const struct timespec *start)
+{
+    return (int64_t)(end->tv_sec - start->tv_sec) * NSEC_PER_SEC +
+            (end->tv_nsec - start->tv_nsec);
+}
+
+/* must be called with output stream mutex locked, before out->standby changes */
+static void out_stats_transition(struct alsa_stream_out *out)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (out->standby)
+        out->stats.standby_ns += timespec_diff_ns(&now, &out->stats.last_transition);
+    else
+        out->stats.active_ns += timespec_diff_ns(&now, &out->stats.last_transition);
+    out->stats.last_transition = now;
+}
+
+static enum output_profile_id select_output_profile(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    int id;
+
+    if (property_get("audio_hal.output_profile", value, NULL) > 0) {
+        for (id = 0; id < OUT_PROFILE_CNT; id++) {
+            if (strcmp(value, default_output_profiles[id].tag) == 0)
+                return id;
+        }
+        ALOGW("audio_hal.output_profile: unknown profile %s", value);
+    }
+    return OUT_PROFILE_PRIMARY;
+}
+
+static void load_output_profile(enum output_profile_id id, struct output_profile *profile)
+{
+    char key[64];
+    int32_t val;
+
+    *profile = default_output_profiles[id];
+
+    snprintf(key, sizeof(key), "audio_hal.%s.period_size", profile->tag);
+    val = property_get_int32(key, profile->period_size);
+    /* keep periods a whole number of base blocks */
+    if (val >= CODEC_BASE_FRAME_COUNT)
+        profile->period_size = (val / CODEC_BASE_FRAME_COUNT) * CODEC_BASE_FRAME_COUNT;
+
+    snprintf(key, sizeof(key), "audio_hal.%s.period_count", profile->tag);
+    val = property_get_int32(key, profile->period_count);
+    if (val >= 2)
+        profile->period_count = val;
+
+    snprintf(key, sizeof(key), "audio_hal.%s.start_threshold", profile->tag);
+    val = property_get_int32(key, profile->start_threshold);
+    if (val >= 1)
+        profile->start_threshold = val;
+    if (profile->start_threshold > profile->period_count)
+        profile->start_threshold = profile->period_count;
+
+    ALOGI("output profile %s: period_size=%u period_count=%u start_threshold=%u",
+            profile->name, profile->period_size, profile->period_count,
+            profile->start_threshold);
+}
+
+static int16_t gain_from_db(float db)
+{
+    float gain = powf(10.0f, db / 20.0f) * SW_GAIN_UNITY;
+
+    if (gain > INT16_MAX)
+        gain = INT16_MAX;
+    return (int16_t)lrintf(gain);
+}
+
+static int16_t load_sw_gain(struct alsa_audio_device *adev)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    if (property_get("audio_hal.sw_gain_db", value, NULL) > 0)
+        return gain_from_db(strtof(value, NULL));
+    if (adev->dsp_gain > 0)
+        return adev->dsp_gain;
+    return SW_GAIN_UNITY;
+}
+
+static void timespec_add_ns(struct timespec *ts, int64_t ns)
+{
+    ts->tv_sec += ns / NSEC_PER_SEC;
+    ts->tv_nsec += ns % NSEC_PER_SEC;
+    if (ts->tv_nsec >= NSEC_PER_SEC) {
+        ts->tv_sec++;
+        ts->tv_nsec -= NSEC_PER_SEC;
+    }
+}
+
+static void *dsp_worker_thread(void *context)
+{
+    struct dsp_worker *worker = (struct dsp_worker *)context;
+    struct misc_io_pcm_buf_param pcmbuf;
+    int ret;
+
+    pthread_mutex_lock(&worker->lock);
+    while (!worker->exit) {
+        if (!worker->queued) {
+            pthread_cond_wait(&worker->cond, &worker->lock);
+            continue;
+        }
+        worker->queued = false;
+        pcmbuf.buf = (uint64_t)(uintptr_t)worker->buf;
+        pcmbuf.buf_size = worker->bytes;
+        pthread_mutex_unlock(&worker->lock);
+
+        ret = ioctl(worker->fd, HIFI_MISC_IOCTL_PCM_GAIN, &pcmbuf);
+
+        pthread_mutex_lock(&worker->lock);
+        worker->result = ret ? -errno : 0;
+        if (worker->waiting) {
+            worker->done = true;
+            pthread_cond_broadcast(&worker->cond);
+        } else {
+            /* the writer gave up on this buffer */
+            worker->busy = false;
+        }
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    close(worker->fd);
+    pthread_cond_destroy(&worker->cond);
+    pthread_mutex_destroy(&worker->lock);
+    free(worker->buf);
+    free(worker);
+    return NULL;
+}
+
+/* Takes over fd, which is closed by the worker thread */
+static struct dsp_worker *dsp_worker_create(int fd)
+{
+    struct dsp_worker *worker;
+    pthread_condattr_t attr;
+    pthread_attr_t thread_attr;
+    pthread_t thread;
+
+    worker = (struct dsp_worker *)calloc(1, sizeof(struct dsp_worker));
+    if (!worker) {
+        close(fd);
+        return NULL;
+    }
+    worker->fd = fd;
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&worker->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_attr_init(&thread_attr);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &thread_attr, dsp_worker_thread, worker) != 0) {
+        pthread_attr_destroy(&thread_attr);
+        pthread_cond_destroy(&worker->cond);
+        pthread_mutex_destroy(&worker->lock);
+        close(fd);
+        free(worker);
+        return NULL;
+    }
+    pthread_attr_destroy(&thread_attr);
+    return worker;
+}
+
+static void dsp_worker_release(struct dsp_worker *worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    worker->exit = true;
+    pthread_cond_broadcast(&worker->cond);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+/* Runs PCM_GAIN on bytes of src and copies the result to dst. Returns -ETIMEDOUT if the
+ * DSP did not answer within timeout_ns, and -EBUSY while it has not answered an earlier
+ * request.
+ */
+static int dsp_worker_process(struct dsp_worker *worker, void *dst, const void *src,
+        size_t bytes, int64_t timeout_ns)
+{
+    struct timespec deadline;
+    int ret;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->busy) {
+        pthread_mutex_unlock(&worker->lock);
+        return -EBUSY;
+    }
+    if (bytes > worker->buf_size) {
+        int16_t *buf = realloc(worker->buf, bytes);
+        if (buf == NULL) {
+            pthread_mutex_unlock(&worker->lock);
+            return -ENOMEM;
+        }
+        worker->buf = buf;
+        worker->buf_size = bytes;
+    }
+    memcpy(worker->buf, src, bytes);
+    worker->bytes = bytes;
+    worker->queued = true;
+    worker->busy = true;
+    worker->waiting = true;
+    worker->done = false;
+    pthread_cond_broadcast(&worker->cond);
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    timespec_add_ns(&deadline, timeout_ns);
+    while (!worker->done) {
+        if (pthread_cond_timedwait(&worker->cond, &worker->lock, &deadline) == ETIMEDOUT)
+            break;
+    }
+    if (worker->done) {
+        ret = worker->result;
+        if (ret == 0)
+            memcpy(dst, worker->buf, bytes);
+        worker->busy = false;
+    } else {
+        /* the thread releases the request when the ioctl returns */
+        ret = -ETIMEDOUT;
+    }
+    worker->waiting = false;
+    pthread_mutex_unlock(&worker->lock);
+    return ret;
+}
+
+/* Measures the gain of PCM_GAIN on a constant buffer, once the output settled. Returns
+ * the Q14 gain, or 0 if the DSP did not process the probe.
+ */
+static int16_t dsp_measure_gain(struct dsp_worker *worker)
+{
+    int16_t probe[DSP_GAIN_PROBE_SAMPLES];
+    int32_t gain;
+    size_t i;
+    int ret;
+
+    for (i = 0; i < DSP_GAIN_PROBE_SAMPLES; i++)
+        probe[i] = DSP_GAIN_PROBE_LEVEL;
+    ret = dsp_worker_process(worker, probe, probe, sizeof(probe), DSP_GAIN_PROBE_TIMEOUT_NS);
+    if (ret != 0) {
+        ALOGW("hifi_dsp: cannot measure PCM_GAIN: %d", ret);
+        return 0;
+    }
+    gain = ((int32_t)probe[DSP_GAIN_PROBE_SAMPLES - 1] * SW_GAIN_UNITY +
+            DSP_GAIN_PROBE_LEVEL / 2) / DSP_GAIN_PROBE_LEVEL;
+    if (gain <= 0 || gain > INT16_MAX) {
+        ALOGW("hifi_dsp: PCM_GAIN gain %d/%d cannot be mirrored", gain, SW_GAIN_UNITY);
+        return 0;
+    }
+    return gain;
+}
+
+/* dst and src may be the same buffer */
+static void sw_pcm_gain(int16_t *dst, const int16_t *src, size_t samples, int16_t gain)
+{
+    size_t i = 0;
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    int16x4_t g = vdup_n_s16(gain);
+
+    for (; i + 8 <= samples; i += 8) {
+        int16x8_t in = vld1q_s16(src + i);
+        int32x4_t lo = vmull_s16(vget_low_s16(in), g);
+        int32x4_t hi = vmull_s16(vget_high_s16(in), g);
+        vst1q_s16(dst + i, vcombine_s16(vqrshrn_n_s32(lo, SW_GAIN_Q),
+                vqrshrn_n_s32(hi, SW_GAIN_Q)));
+    }
+#endif
+    for (; i < samples; i++) {
+        int32_t v = ((int32_t)src[i] * gain + (1 << (SW_GAIN_Q - 1))) >> SW_GAIN_Q;
+        dst[i] = v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+    }
+}
+
+/* must be called with output stream mutex locked */
+static bool out_dsp_available(struct alsa_stream_out *out)
+{
+    struct timespec now;
+
+    if (out->dev->dsp_worker == NULL)
+        return false;
+    if (out->dsp.bypass_until.tv_sec == 0 && out->dsp.bypass_until.tv_nsec == 0)
+        return true;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (timespec_diff_ns(&now, &out->dsp.bypass_until) < 0)
+        return false;
+    /* back off over, probe the DSP again */
+    out->dsp.bypass_until.tv_sec = 0;
+    out->dsp.bypass_until.tv_nsec = 0;
+    out->dsp.latency_avg_ns = 0;
+    return true;
+}
+
+/* must be called with output stream mutex locked. Returns 0 if the DSP processed the buffer
+ * into out->dsp.proc_buf
+ */
+static int out_dsp_process(struct alsa_stream_out *out, const void *buffer, size_t bytes)
+{
+    struct timespec start, end;
+    int64_t latency_ns;
+    int ret;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ret = dsp_worker_process(out->dev->dsp_worker, out->dsp.proc_buf, buffer, bytes,
+            out->dsp.timeout_ns);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    latency_ns = timespec_diff_ns(&end, &start);
+    if (latency_ns > out->dsp.latency_max_ns)
+        out->dsp.latency_max_ns = latency_ns;
+    if (out->dsp.latency_avg_ns == 0)
+        out->dsp.latency_avg_ns = latency_ns;
+    else
+        out->dsp.latency_avg_ns += (latency_ns - out->dsp.latency_avg_ns) / 8;
+
+    if (ret == -ETIMEDOUT || ret == -EBUSY) {
+        ALOGW_IF(ret == -ETIMEDOUT, "hifi_dsp: PCM_GAIN did not answer in %lld us",
+                (long long)(out->dsp.timeout_ns / 1000));
+        out->dsp.dsp_timeouts++;
+    } else if (ret) {
+        ALOGV("hifi_dsp: Error buffer processing: %d", ret);
+        out->dsp.dsp_errors++;
+    } else if (out->dsp.latency_avg_ns > out->dsp.budget_ns) {
+        ALOGW("hifi_dsp: PCM_GAIN takes %lld us, over %lld us budget",
+                (long long)(out->dsp.latency_avg_ns / 1000),
+                (long long)(out->dsp.budget_ns / 1000));
+        out->dsp.dsp_slow++;
+    } else {
+        return 0;
+    }
+
+    /* This buffer (if the ioctl failed) and the next ones go through the CPU path */
+    out->dsp.bypass_until = end;
+    timespec_add_ns(&out->dsp.bypass_until, DSP_BYPASS_BACKOFF_NS);
+    return ret ? -EIO : 0;
+}
+
+/* must be called with output stream mutex locked. Returns the buffer to write to the PCM */
+static const void *out_process(struct alsa_stream_out *out, const void *buffer, size_t bytes)
+{
+    if (bytes > out->dsp.proc_buf_size) {
+        int16_t *buf = realloc(out->dsp.proc_buf, bytes);
+        if (buf == NULL)
+            return buffer;
+        out->dsp.proc_buf = buf;
+        out->dsp.proc_buf_size = bytes;
+    }
+
+    if (out_dsp_available(out) && out_dsp_process(out, buffer, bytes) == 0) {
+        out->dsp.dsp_writes++;
+        return out->dsp.proc_buf;
+    }
+
+    if (out->dsp.sw_gain == SW_GAIN_UNITY)
+        return buffer;
+
+    sw_pcm_gain(out->dsp.proc_buf, buffer, bytes / sizeof(int16_t), out->dsp.sw_gain);
+    out->dsp.cpu_writes++;
+    return out->dsp.proc_buf;
+}
+
 
 /* must be called with hw device and output stream mutexes locked */
 static int start_output_stream(struct alsa_stream_out *out)
@@ -96,12 +602,11 @@ static int start_output_stream(struct alsa_stream_out *out)
     if (out->unavailable)
         return -ENODEV;
 
-    /* default to low power: will be corrected in out_write if necessary before first write to
-     * tinyalsa.
-     */
-    out->write_threshold = PLAYBACK_PERIOD_COUNT * PERIOD_SIZE;
-    out->config.start_threshold = PLAYBACK_PERIOD_START_THRESHOLD * PERIOD_SIZE;
-    out->config.avail_min = PERIOD_SIZE;
+    out->config.period_size = out->profile.period_size;
+    out->config.period_count = out->profile.period_count;
+    out->write_threshold = out->profile.period_count * out->profile.period_size;
+    out->config.start_threshold = out->profile.start_threshold * out->profile.period_size;
+    out->config.avail_min = out->profile.period_size;
 
     out->pcm = pcm_open(CARD_OUT, PORT_CODEC, PCM_OUT | PCM_MMAP | PCM_NOIRQ | PCM_MONOTONIC, &out->config);
 
@@ -133,9 +638,11 @@ static size_t out_get_buffer_size(const struct audio_stream *stream)
 {
     ALOGV("out_get_buffer_size: %d", 4096);
 
+    struct alsa_stream_out *out = (struct alsa_stream_out *)stream;
+
     /* return the closest majoring multiple of 16 frames, as
      * audioflinger expects audio buffers to be a multiple of 16 frames */
-    size_t size = PERIOD_SIZE;
+    size_t size = out->profile.period_size;
     size = ((size + 15) / 16) * 16;
     return size * audio_stream_out_frame_size((struct audio_stream_out *)stream);
 }
@@ -168,6 +675,7 @@ static int do_output_standby(struct alsa_stream_out *out)
         pcm_close(out->pcm);
         out->pcm = NULL;
         adev->active_output = NULL;
+        out_stats_transition(out);
         out->standby = 1;
     }
     return 0;
@@ -190,6 +698,41 @@ static int out_standby(struct audio_stream *stream)
 static int out_dump(const struct audio_stream *stream, int fd)
 {
     ALOGV("out_dump");
+    struct alsa_stream_out *out = (struct alsa_stream_out *)stream;
+    struct timespec now;
+    int64_t active_ns, standby_ns, elapsed_ns;
+
+    pthread_mutex_lock(&out->lock);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    active_ns = out->stats.active_ns;
+    standby_ns = out->stats.standby_ns;
+    if (out->standby)
+        standby_ns += timespec_diff_ns(&now, &out->stats.last_transition);
+    else
+        active_ns += timespec_diff_ns(&now, &out->stats.last_transition);
+
+    dprintf(fd, "      Output profile %s: period_size=%u period_count=%u start_threshold=%u\n",
+            out->profile.name, out->profile.period_size, out->profile.period_count,
+            out->profile.start_threshold);
+    dprintf(fd, "      State: %s, starts=%u\n",
+            out->standby ? "standby" : "active", out->stats.starts);
+    dprintf(fd, "      Residency: active=%lld ms standby=%lld ms\n",
+            (long long)(active_ns / NSEC_PER_MSEC), (long long)(standby_ns / NSEC_PER_MSEC));
+    elapsed_ns = active_ns > 0 ? active_ns : 1;
+    dprintf(fd, "      Wakeups: writes=%llu frames=%llu (%.1f writes/s while active)\n",
+            (unsigned long long)out->stats.writes, (unsigned long long)out->stats.frames,
+            (double)out->stats.writes * NSEC_PER_SEC / elapsed_ns);
+    dprintf(fd, "      Processing: dsp=%llu cpu=%llu dsp_errors=%u dsp_slow=%u dsp_timeouts=%u "
+            "sw_gain=%d/%d\n",
+            (unsigned long long)out->dsp.dsp_writes, (unsigned long long)out->dsp.cpu_writes,
+            out->dsp.dsp_errors, out->dsp.dsp_slow, out->dsp.dsp_timeouts, out->dsp.sw_gain,
+            SW_GAIN_UNITY);
+    dprintf(fd, "      PCM_GAIN latency: avg=%lld us max=%lld us budget=%lld us timeout=%lld us\n",
+            (long long)(out->dsp.latency_avg_ns / 1000),
+            (long long)(out->dsp.latency_max_ns / 1000),
+            (long long)(out->dsp.budget_ns / 1000),
+            (long long)(out->dsp.timeout_ns / 1000));
+    pthread_mutex_unlock(&out->lock);
     return 0;
 }
 
@@ -231,7 +774,7 @@ static uint32_t out_get_latency(const struct audio_stream_out *stream)
 {
     ALOGV("out_get_latency");
     struct alsa_stream_out *out = (struct alsa_stream_out *)stream;
-    return (PERIOD_SIZE * PLAYBACK_PERIOD_COUNT * 1000) / out->config.rate;
+    return (out->profile.period_size * out->profile.period_count * 1000) / out->config.rate;
 }
 
 static int out_set_volume(struct audio_stream_out *stream, float left,
@@ -249,7 +792,6 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
     struct alsa_audio_device *adev = out->dev;
     size_t frame_size = audio_stream_out_frame_size(stream);
     size_t out_frames = bytes / frame_size;
-    struct misc_io_pcm_buf_param pcmbuf;
 
     /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
      * on the output stream mutex - e.g. executing select_mode() while holding the hw device
@@ -257,29 +799,26 @@ static ssize_t out_write(struct audio_stream_out *stream, const void* buffer,
      */
     pthread_mutex_lock(&adev->lock);
     pthread_mutex_lock(&out->lock);
+    out->stats.writes++;
     if (out->standby) {
         ret = start_output_stream(out);
         if (ret != 0) {
             pthread_mutex_unlock(&adev->lock);
             goto exit;
         }
+        out_stats_transition(out);
         out->standby = 0;
+        out->stats.starts++;
     }
 
     pthread_mutex_unlock(&adev->lock);
 
-    if (adev->hifi_dsp_fd >= 0) {
-        pcmbuf.buf = (uint64_t)buffer;
-        pcmbuf.buf_size = bytes;
-        ret = ioctl(adev->hifi_dsp_fd, HIFI_MISC_IOCTL_PCM_GAIN, &pcmbuf);
-        if (ret) {
-            ALOGV("hifi_dsp: Error buffer processing: %d", errno);
-        }
-    }
+    buffer = out_process(out, buffer, bytes);
 
     ret = pcm_mmap_write(out->pcm, buffer, out_frames * frame_size);
     if (ret == 0) {
         out->written += out_frames;
+        out->stats.frames += out_frames;
     }
 exit:
     pthread_mutex_unlock(&out->lock);
@@ -474,8 +1013,15 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->config.channels = CHANNEL_STEREO;
     out->config.rate = CODEC_SAMPLING_RATE;
     out->config.format = PCM_FORMAT_S16_LE;
-    out->config.period_size = PERIOD_SIZE;
-    out->config.period_count = PLAYBACK_PERIOD_COUNT;
+
+    out->profile_id = select_output_profile();
+    load_output_profile(out->profile_id, &out->profile);
+    out->config.period_size = out->profile.period_size;
+    out->config.period_count = out->profile.period_count;
+
+    out->dsp.sw_gain = load_sw_gain(ladev);
+    out->dsp.timeout_ns = (int64_t)out->profile.period_size * NSEC_PER_SEC / out->config.rate;
+    out->dsp.budget_ns = out->dsp.timeout_ns / DSP_LATENCY_BUDGET_DIVIDER;
 
     if (out->config.rate != config->sample_rate ||
            audio_channel_count_from_out_mask(config->channel_mask) != CHANNEL_STEREO ||
@@ -492,6 +1038,7 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->dev = ladev;
     out->standby = 1;
     out->unavailable = false;
+    clock_gettime(CLOCK_MONOTONIC, &out->stats.last_transition);
 
     config->format = out_get_format(&out->stream.common);
     config->channel_mask = out_get_channels(&out->stream.common);
@@ -508,7 +1055,11 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
 static void adev_close_output_stream(struct audio_hw_device *dev,
         struct audio_stream_out *stream)
 {
+    struct alsa_stream_out *out = (struct alsa_stream_out *)stream;
+
     ALOGV("adev_close_output_stream...");
+    out_standby(&stream->common);
+    free(out->dsp.proc_buf);
     free(stream);
 }
 
@@ -641,8 +1192,8 @@ static int adev_close(hw_device_t *device)
     struct alsa_audio_device *adev = (struct alsa_audio_device *)device;
 
     ALOGV("adev_close");
-    if (adev->hifi_dsp_fd >= 0)
-        close(adev->hifi_dsp_fd);
+    if (adev->dsp_worker != NULL)
+        dsp_worker_release(adev->dsp_worker);
     free(device);
     return 0;
 }
@@ -651,6 +1202,8 @@ static int adev_open(const hw_module_t* module, const char* name,
         hw_device_t** device)
 {
     struct alsa_audio_device *adev;
+    char value[PROPERTY_VALUE_MAX];
+    int fd;
 
     ALOGV("adev_open: %s", name);
 
@@ -687,12 +1240,19 @@ static int adev_open(const hw_module_t* module, const char* name,
 
     *device = &adev->hw_device.common;
 
-    adev->hifi_dsp_fd = open(HIFI_DSP_MISC_DRIVER, O_WRONLY, 0);
-    if (adev->hifi_dsp_fd < 0) {
+    fd = open(HIFI_DSP_MISC_DRIVER, O_WRONLY, 0);
+    if (fd < 0) {
         ALOGW("hifi_dsp: Error opening device %d", errno);
     } else {
         ALOGI("hifi_dsp: Open device");
+        adev->dsp_worker = dsp_worker_create(fd);
     }
+    if (adev->dsp_worker != NULL)
+        adev->dsp_gain = dsp_measure_gain(adev->dsp_worker);
+    if (adev->dsp_gain > 0)
+        ALOGI("hifi_dsp: PCM_GAIN measured at %d/%d", adev->dsp_gain, SW_GAIN_UNITY);
+    else if (property_get("audio_hal.sw_gain_db", value, NULL) <= 0)
+        ALOGW("hifi_dsp: gain unknown, set audio_hal.sw_gain_db for the software fallback");
     return 0;
 }
 
@@ -0,0 +1,73 @@
+# Copyright (C) 2017 The Android Open Source Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Host stand-ins for /dev/hifi_misc and the codec PCM, so that the primary HAL
+# can be exercised and benchmarked on a build host:
+#
+#   LD_PRELOAD=libfakehifi.so audio_hal_bench -m audio.primary.fake.so
+#
+# See fake_hifi_misc.c and fake_pcm.c for the environment variables that set
+# latency and inject failures.
+
+LOCAL_PATH := $(call my-dir)
+
+# LD_PRELOAD shim implementing the audio_hifi.h ioctls
+include $(CLEAR_VARS)
+LOCAL_MODULE := libfakehifi
+LOCAL_MODULE_HOST_OS := linux
+LOCAL_SRC_FILES := fake_hifi_misc.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/../../kernel-headers
+LOCAL_CFLAGS := -Wno-unused-parameter
+LOCAL_LDLIBS := -ldl -lpthread
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+# tinyalsa replacement consuming playback in real time
+include $(CLEAR_VARS)
+LOCAL_MODULE := libtinyalsa_fake
+LOCAL_MODULE_HOST_OS := linux
+LOCAL_SRC_FILES := fake_pcm.c
+LOCAL_C_INCLUDES := external/tinyalsa/include
+LOCAL_CFLAGS := -Wno-unused-parameter
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+# The primary HAL built for the host against the fake PCM
+include $(CLEAR_VARS)
+LOCAL_MODULE := audio.primary.fake
+LOCAL_MODULE_HOST_OS := linux
+LOCAL_SRC_FILES := ../audio_hw.c
+LOCAL_STATIC_LIBRARIES := libtinyalsa_fake
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+LOCAL_CFLAGS := -Wno-unused-parameter
+LOCAL_LDLIBS := -lm -lpthread
+LOCAL_C_INCLUDES += \
+        external/tinyalsa/include \
+        external/expat/lib \
+        hardware/libhardware/include \
+        system/media/audio/include \
+        system/media/audio_utils/include \
+        system/media/audio_effects/include \
+        $(LOCAL_PATH)/../../kernel-headers
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+# Drives one output stream of a HAL module and reports out_write() timing
+include $(CLEAR_VARS)
+LOCAL_MODULE := audio_hal_bench
+LOCAL_MODULE_HOST_OS := linux
+LOCAL_SRC_FILES := audio_hal_bench.c
+LOCAL_CFLAGS := -Wno-unused-parameter
+LOCAL_C_INCLUDES += \
+        hardware/libhardware/include \
+        system/media/audio/include
+LOCAL_LDLIBS := -ldl -lm
+include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Drive the hikey audio HAL built for the host against the fake PCM, with
+ * libfakehifi.so preloaded in place of /dev/hifi_misc:
+ *
+ *   LD_PRELOAD=libfakehifi.so FAKE_HIFI_LATENCY_US=3000 \
+ *       audio_hal_bench -m audio.primary.fake.so -n 500
+ *
+ * Opens the primary output stream, writes a sine wave period by period
+ * (optionally putting the stream in standby every few writes) and reports the
+ * time spent in out_write() followed by the stream dump. The period layout is
+ * the one audio_hal.output_profile selects.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/audio.h>
+#include <hardware/hardware.h>
+#include <system/audio.h>
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return x < y ? -1 : (x > y);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-m module.so] [-n writes] [-s standby_every]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *module_path = "audio.primary.fake.so";
+    audio_output_flags_t flags = AUDIO_OUTPUT_FLAG_PRIMARY;
+    unsigned int writes = 500, standby_every = 0, errors = 0;
+    struct audio_config config = {
+        .sample_rate = 48000,
+        .channel_mask = AUDIO_CHANNEL_OUT_STEREO,
+        .format = AUDIO_FORMAT_PCM_16_BIT,
+    };
+    struct hw_module_t *module;
+    struct hw_device_t *device;
+    struct audio_hw_device *adev;
+    struct audio_stream_out *out;
+    size_t buffer_size, frame_size, offset, i;
+    int16_t *buffer;
+    int64_t *samples, start, total_ns;
+    void *handle;
+    unsigned int n;
+    int opt;
+    ssize_t ret;
+
+    while ((opt = getopt(argc, argv, "m:n:s:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            module_path = optarg;
+            break;
+        case 'n':
+            writes = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            standby_every = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (writes == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    handle = dlopen(module_path, RTLD_NOW);
+    if (handle == NULL) {
+        fprintf(stderr, "cannot load %s: %s\n", module_path, dlerror());
+        return 1;
+    }
+    module = (struct hw_module_t *)dlsym(handle, HAL_MODULE_INFO_SYM_AS_STR);
+    if (module == NULL || module->methods->open(module, AUDIO_HARDWARE_INTERFACE, &device)) {
+        fprintf(stderr, "cannot open audio device from %s\n", module_path);
+        return 1;
+    }
+    adev = (struct audio_hw_device *)device;
+
+    if (adev->open_output_stream(adev, 0, AUDIO_DEVICE_OUT_SPEAKER, flags, &config, &out,
+            "") != 0) {
+        fprintf(stderr, "cannot open output stream\n");
+        return 1;
+    }
+
+    buffer_size = out->common.get_buffer_size(&out->common);
+    frame_size = audio_stream_out_frame_size(out);
+    buffer = malloc(buffer_size);
+    samples = malloc(sizeof(samples[0]) * writes);
+    if (buffer == NULL || samples == NULL)
+        return 1;
+    /* 1 kHz tone at -6 dBFS */
+    for (i = 0; i < buffer_size / frame_size; i++) {
+        int16_t v = (int16_t)(16384 * sin(2 * M_PI * 1000 * i / config.sample_rate));
+        buffer[2 * i] = v;
+        buffer[2 * i + 1] = v;
+    }
+
+    printf("%s: flags %#x, buffer %zu bytes, latency %u ms, %u writes\n", module_path, flags,
+            buffer_size, out->get_latency(out), writes);
+
+    total_ns = now_ns();
+    for (n = 0; n < writes; n++) {
+        if (standby_every && n > 0 && n % standby_every == 0)
+            out->common.standby(&out->common);
+
+        start = now_ns();
+        offset = 0;
+        while (offset < buffer_size) {
+            ret = out->write(out, (uint8_t *)buffer + offset, buffer_size - offset);
+            if (ret < 0) {
+                /* the rest of this period is lost, as it would be for a player */
+                errors++;
+                break;
+            }
+            offset += ret;
+        }
+        samples[n] = now_ns() - start;
+    }
+    total_ns = now_ns() - total_ns;
+
+    qsort(samples, writes, sizeof(samples[0]), compare_int64);
+    printf("out_write: p50=%lld us p99=%lld us max=%lld us, %.1f writes/s, %u errors\n",
+            (long long)(samples[(writes - 1) * 50 / 100] / 1000),
+            (long long)(samples[(writes - 1) * 99 / 100] / 1000),
+            (long long)(samples[writes - 1] / 1000),
+            writes * 1e9 / total_ns, errors);
+
+    fflush(stdout);
+    out->common.dump(&out->common, STDOUT_FILENO);
+
+    adev->close_output_stream(adev, out);
+    device->close(device);
+    free(samples);
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * LD_PRELOAD stand-in for /dev/hifi_misc.
+ *
+ * open() of HIFI_DSP_MISC_DRIVER returns a descriptor on /dev/null that is
+ * remembered as the fake DSP; ioctl() on it implements the audio_hifi.h
+ * requests used by the HAL and the hifi tools. mmap() of it gives anonymous
+ * shared memory standing in for the HiFi shared region, at FAKE_HIFI_SHMEM_ADDR
+ * on the DSP side; XAF messages addressing anything else fail with EFAULT.
+ * Behaviour is controlled with environment variables:
+ *
+ *   FAKE_HIFI_ABSENT=1         open() fails with ENOENT
+ *   FAKE_HIFI_LATENCY_US=n     added to every ioctl
+ *   FAKE_HIFI_JITTER_US=n      random extra latency in [0, n)
+ *   FAKE_HIFI_FAIL_EVERY=n     every n-th ioctl fails with FAKE_HIFI_FAIL_ERRNO (EIO)
+ *   FAKE_HIFI_HANG_AFTER=n     ioctls after the n-th block for FAKE_HIFI_HANG_US (1 s)
+ *   FAKE_HIFI_GAIN_Q14=n       gain applied by PCM_GAIN (16384 = unity)
+ *
+ * Usage: LD_PRELOAD=libfakehifi.so bench-hifi ...
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/audio_hifi.h>
+
+#define FAKE_LOG "fake hifi: dsp log line\n"
+#define FAKE_HIFI_SHMEM_ADDR 0x8b300000ULL
+
+struct fake_hifi {
+    pthread_once_t once;
+    pthread_mutex_t lock;
+    int fd;
+    unsigned int latency_us;
+    unsigned int jitter_us;
+    unsigned int fail_every;
+    int fail_errno;
+    unsigned int hang_after;
+    unsigned int hang_us;
+    int32_t gain_q14;
+    bool absent;
+    unsigned long calls;
+    xf_proxy_msg_t pending;
+    bool has_pending;
+    size_t log_len;
+    size_t shmem_size;     /* mapped through the fake descriptor */
+};
+
+static struct fake_hifi fake = {
+    .once = PTHREAD_ONCE_INIT,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .fd = -1,
+};
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static void *(*real_mmap)(void *, size_t, int, int, int, off_t);
+
+static unsigned int env_uint(const char *name, unsigned int def)
+{
+    const char *value = getenv(name);
+
+    return value ? strtoul(value, NULL, 0) : def;
+}
+
+static void fake_init(void)
+{
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+    real_mmap = dlsym(RTLD_NEXT, "mmap");
+
+    fake.absent = env_uint("FAKE_HIFI_ABSENT", 0) != 0;
+    fake.latency_us = env_uint("FAKE_HIFI_LATENCY_US", 0);
+    fake.jitter_us = env_uint("FAKE_HIFI_JITTER_US", 0);
+    fake.fail_every = env_uint("FAKE_HIFI_FAIL_EVERY", 0);
+    fake.fail_errno = env_uint("FAKE_HIFI_FAIL_ERRNO", EIO);
+    fake.hang_after = env_uint("FAKE_HIFI_HANG_AFTER", 0);
+    fake.hang_us = env_uint("FAKE_HIFI_HANG_US", 1000000);
+    fake.gain_q14 = env_uint("FAKE_HIFI_GAIN_Q14", 1 << 14);
+}
+
+static void sleep_us(unsigned int us)
+{
+    struct timespec ts = { us / 1000000, (us % 1000000) * 1000L };
+
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+        ;
+}
+
+static void pcm_gain(int16_t *samples, size_t count, int32_t gain)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        int32_t v = ((int32_t)samples[i] * gain + (1 << 13)) >> 14;
+        samples[i] = v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+    }
+}
+
+/* Called with fake.lock held */
+static int fake_request(unsigned long request, void *arg)
+{
+    switch (request) {
+    case HIFI_MISC_IOCTL_PCM_GAIN: {
+        struct misc_io_pcm_buf_param *pcmbuf = arg;
+
+        pcm_gain((int16_t *)(uintptr_t)pcmbuf->buf, pcmbuf->buf_size / sizeof(int16_t),
+                fake.gain_q14);
+        return 0;
+    }
+    case HIFI_MISC_IOCTL_SYNCMSG: {
+        struct misc_io_sync_param *sync = arg;
+        size_t len = sync->para_size_in < sync->para_size_out ?
+                sync->para_size_in : sync->para_size_out;
+
+        memmove((void *)(uintptr_t)(((uint64_t)sync->para_out_h << 32) | sync->para_out_l),
+                (void *)(uintptr_t)(((uint64_t)sync->para_in_h << 32) | sync->para_in_l), len);
+        return 0;
+    }
+    case HIFI_MISC_IOCTL_GET_PHYS: {
+        struct misc_io_get_phys_param *phys = arg;
+
+        phys->phys_addr_l = (uint32_t)FAKE_HIFI_SHMEM_ADDR;
+        phys->phys_addr_h = (uint32_t)(FAKE_HIFI_SHMEM_ADDR >> 32);
+        return 0;
+    }
+    case HIFI_MISC_IOCTL_DISPLAY_MSG: {
+        struct misc_io_dump_buf_param *dump = arg;
+        char *buf = (char *)(uintptr_t)dump->user_buf;
+        size_t len;
+
+        if (dump->buf_size == 0)
+            return 0;
+        /* the log grows by one line per read until it is cleared */
+        if (fake.log_len + sizeof(FAKE_LOG) <= dump->buf_size)
+            fake.log_len += sizeof(FAKE_LOG) - 1;
+        for (len = 0; len < fake.log_len; len += sizeof(FAKE_LOG) - 1)
+            memcpy(buf + len, FAKE_LOG, sizeof(FAKE_LOG) - 1);
+        buf[len] = '\0';
+        if (dump->clear)
+            fake.log_len = 0;
+        return len + 1;
+    }
+    case HIFI_MISC_IOCTL_XAF_IPC_MSG_SEND: {
+        xf_proxy_msg_t *msg = arg;
+
+        if (msg->address < FAKE_HIFI_SHMEM_ADDR ||
+                msg->address + msg->length > FAKE_HIFI_SHMEM_ADDR + fake.shmem_size) {
+            errno = EFAULT;
+            return -1;
+        }
+        fake.pending = *msg;
+        fake.has_pending = true;
+        return 0;
+    }
+    case HIFI_MISC_IOCTL_XAF_IPC_MSG_RECV:
+        if (!fake.has_pending) {
+            errno = EAGAIN;
+            return -1;
+        }
+        *(xf_proxy_msg_t *)arg = fake.pending;
+        fake.has_pending = false;
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+int open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    va_list ap;
+    int fd;
+
+    pthread_once(&fake.once, fake_init);
+    if (flags & O_CREAT) {
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+    if (strcmp(path, HIFI_DSP_MISC_DRIVER) != 0)
+        return real_open(path, flags, mode);
+
+    if (fake.absent) {
+        errno = ENOENT;
+        return -1;
+    }
+    fd = real_open("/dev/null", O_RDWR);
+    if (fd >= 0) {
+        pthread_mutex_lock(&fake.lock);
+        fake.fd = fd;
+        pthread_mutex_unlock(&fake.lock);
+    }
+    return fd;
+}
+
+int open64(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    va_list ap;
+
+    if (flags & O_CREAT) {
+        va_start(ap, flags);
+        mode = va_arg(ap, int);
+        va_end(ap);
+    }
+    return open(path, flags, mode);
+}
+
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+    void *map;
+
+    pthread_once(&fake.once, fake_init);
+    pthread_mutex_lock(&fake.lock);
+    if (fd < 0 || fd != fake.fd) {
+        pthread_mutex_unlock(&fake.lock);
+        return real_mmap(addr, length, prot, flags, fd, offset);
+    }
+    map = real_mmap(addr, length, prot, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (map != MAP_FAILED)
+        fake.shmem_size = length;
+    pthread_mutex_unlock(&fake.lock);
+    return map;
+}
+
+int close(int fd)
+{
+    pthread_once(&fake.once, fake_init);
+    pthread_mutex_lock(&fake.lock);
+    if (fd == fake.fd) {
+        fake.fd = -1;
+        fake.has_pending = false;
+    }
+    pthread_mutex_unlock(&fake.lock);
+    return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+    unsigned long call;
+    unsigned int delay_us;
+    va_list ap;
+    void *arg;
+    int ret;
+
+    va_start(ap, request);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    pthread_once(&fake.once, fake_init);
+    pthread_mutex_lock(&fake.lock);
+    if (fd < 0 || fd != fake.fd) {
+        pthread_mutex_unlock(&fake.lock);
+        return real_ioctl(fd, request, arg);
+    }
+    call = ++fake.calls;
+    pthread_mutex_unlock(&fake.lock);
+
+    /* The DSP round trip happens without the lock, like concurrent callers on the device */
+    delay_us = fake.latency_us;
+    if (fake.jitter_us)
+        delay_us += rand() % fake.jitter_us;
+    if (fake.hang_after && call > fake.hang_after)
+        delay_us += fake.hang_us;
+    if (delay_us)
+        sleep_us(delay_us);
+
+    if (fake.fail_every && call % fake.fail_every == 0) {
+        errno = fake.fail_errno;
+        return -1;
+    }
+
+    pthread_mutex_lock(&fake.lock);
+    ret = fake_request(request, arg);
+    pthread_mutex_unlock(&fake.lock);
+    return ret;
+}
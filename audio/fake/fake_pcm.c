@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fake tinyalsa playback PCM for running the audio HAL on a build host.
+ *
+ * The PCM is consumed in real time from the moment start_threshold frames
+ * have been written; writes block while the ring is full and an underrun
+ * restarts the stream, like an ALSA device does. Behaviour is controlled with
+ * environment variables:
+ *
+ *   FAKE_PCM_FAIL_OPEN=1        pcm_open() returns a PCM that is not ready
+ *   FAKE_PCM_FAIL_WRITE_EVERY=n every n-th write fails with -EIO
+ *   FAKE_PCM_REALTIME=0         never block: the device consumes instantly
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#define NSEC_PER_SEC 1000000000LL
+
+struct pcm {
+    struct pcm_config config;
+    unsigned int flags;
+    bool ready;
+    bool running;
+    int64_t start_ns;
+    uint64_t written;       /* frames since start */
+    unsigned long writes;
+    unsigned long underruns;
+    char error[128];
+};
+
+struct pcm_params {
+    unsigned int card;
+    unsigned int device;
+};
+
+static struct pcm bad_pcm = {
+    .error = "fake pcm: open failed",
+};
+
+static unsigned long env_ulong(const char *name, unsigned long def)
+{
+    const char *value = getenv(name);
+
+    return value ? strtoul(value, NULL, 0) : def;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static unsigned int buffer_frames(const struct pcm *pcm)
+{
+    return pcm->config.period_size * pcm->config.period_count;
+}
+
+/* Frames consumed by the fake device since the stream started */
+static uint64_t hw_frames(const struct pcm *pcm, int64_t now)
+{
+    if (!pcm->running)
+        return 0;
+    if (!env_ulong("FAKE_PCM_REALTIME", 1))
+        return pcm->written;
+    return (uint64_t)(now - pcm->start_ns) * pcm->config.rate / NSEC_PER_SEC;
+}
+
+struct pcm *pcm_open(unsigned int card, unsigned int device,
+                     unsigned int flags, struct pcm_config *config)
+{
+    struct pcm *pcm;
+
+    if (env_ulong("FAKE_PCM_FAIL_OPEN", 0) || config == NULL)
+        return &bad_pcm;
+
+    pcm = calloc(1, sizeof(struct pcm));
+    if (pcm == NULL)
+        return &bad_pcm;
+    pcm->config = *config;
+    if (pcm->config.start_threshold == 0)
+        pcm->config.start_threshold = buffer_frames(pcm);
+    pcm->flags = flags;
+    pcm->ready = true;
+    return pcm;
+}
+
+int pcm_close(struct pcm *pcm)
+{
+    if (pcm == &bad_pcm || pcm == NULL)
+        return 0;
+    if (pcm->underruns)
+        fprintf(stderr, "fake pcm: %lu underruns in %lu writes\n", pcm->underruns, pcm->writes);
+    free(pcm);
+    return 0;
+}
+
+int pcm_is_ready(struct pcm *pcm)
+{
+    return pcm != NULL && pcm->ready;
+}
+
+const char *pcm_get_error(struct pcm *pcm)
+{
+    return pcm->error;
+}
+
+unsigned int pcm_frames_to_bytes(struct pcm *pcm, unsigned int frames)
+{
+    return frames * pcm->config.channels * (pcm_format_to_bits(pcm->config.format) / 8);
+}
+
+unsigned int pcm_bytes_to_frames(struct pcm *pcm, unsigned int bytes)
+{
+    return bytes / (pcm->config.channels * (pcm_format_to_bits(pcm->config.format) / 8));
+}
+
+unsigned int pcm_format_to_bits(enum pcm_format format)
+{
+    switch (format) {
+    case PCM_FORMAT_S32_LE:
+        return 32;
+    case PCM_FORMAT_S24_LE:
+        return 32;
+    default:
+        return 16;
+    }
+}
+
+int pcm_write(struct pcm *pcm, const void *data, unsigned int count)
+{
+    unsigned int frames = pcm_bytes_to_frames(pcm, count);
+    unsigned long fail_every = env_ulong("FAKE_PCM_FAIL_WRITE_EVERY", 0);
+    int64_t now = now_ns();
+    uint64_t hw, queued;
+    struct timespec ts;
+
+    pcm->writes++;
+    if (fail_every && pcm->writes % fail_every == 0) {
+        snprintf(pcm->error, sizeof(pcm->error), "fake pcm: injected write error");
+        return -EIO;
+    }
+
+    hw = hw_frames(pcm, now);
+    if (pcm->running && hw > pcm->written) {
+        /* underrun: the device drained everything, restart like an xrun recovery */
+        pcm->underruns++;
+        pcm->running = false;
+        pcm->written = 0;
+        hw = 0;
+    }
+
+    /* block until the frames fit in the ring */
+    queued = pcm->written - hw;
+    if (pcm->running && queued + frames > buffer_frames(pcm)) {
+        int64_t wait_ns = (int64_t)(queued + frames - buffer_frames(pcm)) * NSEC_PER_SEC /
+                pcm->config.rate;
+        ts.tv_sec = wait_ns / NSEC_PER_SEC;
+        ts.tv_nsec = wait_ns % NSEC_PER_SEC;
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+            ;
+    }
+
+    pcm->written += frames;
+    if (!pcm->running && pcm->written >= pcm->config.start_threshold) {
+        pcm->running = true;
+        pcm->start_ns = now_ns();
+    }
+    return 0;
+}
+
+int pcm_mmap_write(struct pcm *pcm, const void *data, unsigned int count)
+{
+    return pcm_write(pcm, data, count);
+}
+
+int pcm_get_htimestamp(struct pcm *pcm, unsigned int *avail, struct timespec *tstamp)
+{
+    int64_t now = now_ns();
+    uint64_t hw = hw_frames(pcm, now);
+    uint64_t queued = pcm->written > hw ? pcm->written - hw : 0;
+
+    if (!pcm->running)
+        return -1;
+    *avail = buffer_frames(pcm) - (queued > buffer_frames(pcm) ? buffer_frames(pcm) : queued);
+    tstamp->tv_sec = now / NSEC_PER_SEC;
+    tstamp->tv_nsec = now % NSEC_PER_SEC;
+    return 0;
+}
+
+struct pcm_params *pcm_params_get(unsigned int card, unsigned int device,
+                                  unsigned int flags)
+{
+    struct pcm_params *params;
+
+    if (env_ulong("FAKE_PCM_FAIL_OPEN", 0))
+        return NULL;
+    params = calloc(1, sizeof(struct pcm_params));
+    if (params == NULL)
+        return NULL;
+    params->card = card;
+    params->device = device;
+    return params;
+}
+
+void pcm_params_free(struct pcm_params *pcm_params)
+{
+    free(pcm_params);
+}
@@ -14,19 +14,21 @@
 // limitations under the License.
 //
 
+#define LOG_TAG "android.hardware.bluetooth.async_fd_watcher"
+
 #include "async_fd_watcher.h"
 
 #include <algorithm>
 #include <atomic>
-#include <condition_variable>
-#include <map>
 #include <mutex>
 #include <thread>
-#include <vector>
-#include "fcntl.h"
-#include "sys/select.h"
+#include "sys/epoll.h"
+#include "sys/eventfd.h"
+#include "sys/timerfd.h"
 #include "unistd.h"
 
+#include <utils/Log.h>
+
 static const int INVALID_FD = -1;
 
 namespace android {
@@ -34,12 +36,90 @@ namespace hardware {
 namespace bluetooth {
 namespace async {
 
+AsyncFdWatcher::AsyncFdWatcher()
+    : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      notification_fd_(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)),
+      timer_fd_(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) {
+  if (epoll_fd_ == INVALID_FD || notification_fd_ == INVALID_FD ||
+      timer_fd_ == INVALID_FD) {
+    ALOGE("%s: can't create epoll/eventfd/timerfd (%s)", __func__,
+          strerror(errno));
+    return;
+  }
+
+  struct epoll_event event = {};
+  event.events = EPOLLIN | EPOLLET;
+  event.data.u32 = kNotificationIndex;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, notification_fd_, &event)) {
+    ALOGE("%s: can't watch eventfd (%s)", __func__, strerror(errno));
+  }
+  event.data.u32 = kTimerIndex;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, timer_fd_, &event)) {
+    ALOGE("%s: can't watch timerfd (%s)", __func__, strerror(errno));
+  }
+}
+
 int AsyncFdWatcher::WatchFdForNonBlockingReads(
-    int file_descriptor, const ReadCallback& on_read_fd_ready_callback) {
-  // Add file descriptor and callback
+    int file_descriptor, const ReadCallback& on_read_fd_ready_callback,
+    bool edge_triggered) {
+  return updateWatch(file_descriptor, &on_read_fd_ready_callback, nullptr,
+                     edge_triggered);
+}
+
+int AsyncFdWatcher::WatchFdForWrites(
+    int file_descriptor, const WriteCallback& on_write_fd_ready_callback,
+    bool edge_triggered) {
+  return updateWatch(file_descriptor, nullptr, &on_write_fd_ready_callback,
+                     edge_triggered);
+}
+
+int AsyncFdWatcher::updateWatch(int file_descriptor, const ReadCallback* on_read,
+                                const WriteCallback* on_write,
+                                bool edge_triggered) {
+  // Add file descriptor and callbacks
   {
     std::unique_lock<std::mutex> guard(internal_mutex_);
-    watched_fds_[file_descriptor] = on_read_fd_ready_callback;
+    size_t index = kMaxWatchedFds;
+    int op = EPOLL_CTL_ADD;
+    for (size_t i = 0; i < kMaxWatchedFds; i++) {
+      if (watches_[i] != nullptr && watches_[i]->fd == file_descriptor) {
+        index = i;
+        op = EPOLL_CTL_MOD;
+        break;
+      }
+      if (watches_[i] == nullptr && index == kMaxWatchedFds) index = i;
+    }
+    if (index == kMaxWatchedFds) {
+      ALOGE("%s: too many watched file descriptors", __func__);
+      return -1;
+    }
+
+    std::shared_ptr<const Watch> previous = watches_[index];
+    Watch watch{file_descriptor, nullptr, nullptr, edge_triggered};
+    if (previous != nullptr) {
+      // Reads and writes share one epoll registration, and so its mode.
+      if (previous->edge_triggered != edge_triggered) {
+        ALOGE("%s: fd %d is already watched %s-triggered", __func__,
+              file_descriptor, previous->edge_triggered ? "edge" : "level");
+        return -1;
+      }
+      watch = *previous;
+    }
+    if (on_read != nullptr) watch.on_read_fd_ready = *on_read;
+    if (on_write != nullptr) watch.on_write_fd_ready = *on_write;
+    watches_[index] = std::make_shared<const Watch>(watch);
+
+    struct epoll_event event = {};
+    if (watch.on_read_fd_ready) event.events |= EPOLLIN;
+    if (watch.on_write_fd_ready) event.events |= EPOLLOUT;
+    if (watch.edge_triggered) event.events |= EPOLLET;
+    event.data.u32 = index;
+    if (epoll_ctl(epoll_fd_, op, file_descriptor, &event)) {
+      ALOGE("%s: can't watch fd %d (%s)", __func__, file_descriptor,
+            strerror(errno));
+      watches_[index] = previous;
+      return -1;
+    }
   }
 
   // Start the thread if not started yet
@@ -49,32 +129,118 @@ int AsyncFdWatcher::WatchFdForNonBlockingReads(
 int AsyncFdWatcher::ConfigureTimeout(
     const std::chrono::milliseconds timeout,
     const TimeoutCallback& on_timeout_callback) {
-  // Add timeout and callback
+  TimerId previous;
   {
-    std::unique_lock<std::mutex> guard(timeout_mutex_);
-    timeout_cb_ = on_timeout_callback;
-    timeout_ms_ = timeout;
+    std::unique_lock<std::mutex> guard(timer_mutex_);
+    previous = timeout_timer_;
+    timeout_timer_ = 0;
   }
+  if (previous != 0) CancelTimer(previous);
+  if (timeout <= std::chrono::milliseconds(0) || on_timeout_callback == nullptr)
+    return 0;
 
-  notifyThread();
+  TimerId id = ScheduleTimer(timeout, on_timeout_callback, true);
+  if (id == 0) return -1;
+  std::unique_lock<std::mutex> guard(timer_mutex_);
+  timeout_timer_ = id;
   return 0;
 }
 
+TimerId AsyncFdWatcher::ScheduleTimer(TimerClock::time_point deadline,
+                                      const TimerCallback& on_timer_callback,
+                                      TimerClock::duration period) {
+  if (timer_fd_ == INVALID_FD || on_timer_callback == nullptr) return 0;
+
+  TimerId id;
+  {
+    std::unique_lock<std::mutex> guard(timer_mutex_);
+    id = next_timer_id_++;
+    if (next_timer_id_ == 0) next_timer_id_ = 1;
+    timers_[id] = Timer{period, on_timer_callback};
+    deadlines_.push_back(Deadline{deadline, id});
+    std::push_heap(deadlines_.begin(), deadlines_.end());
+    if (deadlines_.front().id == id) armTimerFd();
+  }
+
+  if (tryStartThread()) return 0;
+  return id;
+}
+
+TimerId AsyncFdWatcher::ScheduleTimer(TimerClock::duration delay,
+                                      const TimerCallback& on_timer_callback,
+                                      bool periodic) {
+  return ScheduleTimer(TimerClock::now() + delay, on_timer_callback,
+                       periodic ? delay : TimerClock::duration(0));
+}
+
+bool AsyncFdWatcher::CancelTimer(TimerId id) {
+  std::unique_lock<std::mutex> guard(timer_mutex_);
+  return timers_.erase(id) > 0;
+}
+
+// Called with timer_mutex_ held.
+void AsyncFdWatcher::armTimerFd() {
+  struct itimerspec spec = {};
+  if (!deadlines_.empty()) {
+    auto when = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    deadlines_.front().when.time_since_epoch())
+                    .count();
+    // An all-zero it_value would disarm the timer.
+    if (when <= 0) when = 1;
+    spec.it_value.tv_sec = when / 1000000000LL;
+    spec.it_value.tv_nsec = when % 1000000000LL;
+  }
+  if (timerfd_settime(timer_fd_, TFD_TIMER_ABSTIME, &spec, nullptr))
+    ALOGE("%s: can't arm timerfd (%s)", __func__, strerror(errno));
+}
+
+// Runs on the watcher thread, without holding the lock during callbacks so
+// they can schedule and cancel timers.
+void AsyncFdWatcher::runExpiredTimers() {
+  uint64_t expirations;
+  TEMP_FAILURE_RETRY(read(timer_fd_, &expirations, sizeof(expirations)));
+
+  std::unique_lock<std::mutex> guard(timer_mutex_);
+  TimerClock::time_point now = TimerClock::now();
+  while (running_ && !deadlines_.empty() && deadlines_.front().when <= now) {
+    Deadline expired = deadlines_.front();
+    std::pop_heap(deadlines_.begin(), deadlines_.end());
+    deadlines_.pop_back();
+
+    auto timer = timers_.find(expired.id);
+    if (timer == timers_.end()) continue;  // cancelled
+    TimerCallback on_timer = timer->second.on_timer;
+    TimerClock::duration period = timer->second.period;
+    if (period > TimerClock::duration(0)) {
+      TimerClock::time_point next = expired.when + period;
+      if (next <= now) next += period * ((now - next) / period + 1);
+      deadlines_.push_back(Deadline{next, expired.id});
+      std::push_heap(deadlines_.begin(), deadlines_.end());
+    } else {
+      timers_.erase(timer);
+    }
+
+    guard.unlock();
+    on_timer();
+    guard.lock();
+    now = TimerClock::now();
+  }
+  armTimerFd();
+}
+
 void AsyncFdWatcher::StopWatchingFileDescriptors() { stopThread(); }
 
-AsyncFdWatcher::~AsyncFdWatcher() {}
+AsyncFdWatcher::~AsyncFdWatcher() {
+  stopThread();
+  if (timer_fd_ != INVALID_FD) close(timer_fd_);
+  if (notification_fd_ != INVALID_FD) close(notification_fd_);
+  if (epoll_fd_ != INVALID_FD) close(epoll_fd_);
+}
 
-// Make sure to call this with at least one file descriptor ready to be
-// watched upon or the thread routine will return immediately
 int AsyncFdWatcher::tryStartThread() {
   if (std::atomic_exchange(&running_, true)) return 0;
 
-  // Set up the communication channel
-  int pipe_fds[2];
-  if (pipe2(pipe_fds, O_NONBLOCK)) return -1;
-
-  notification_listen_fd_ = pipe_fds[0];
-  notification_write_fd_ = pipe_fds[1];
+  if (epoll_fd_ == INVALID_FD || notification_fd_ == INVALID_FD) return -1;
 
   thread_ = std::thread([this]() { ThreadRoutine(); });
   if (!thread_.joinable()) return -1;
@@ -92,84 +258,72 @@ int AsyncFdWatcher::stopThread() {
 
   {
     std::unique_lock<std::mutex> guard(internal_mutex_);
-    watched_fds_.clear();
+    for (auto& watch : watches_) {
+      if (watch == nullptr) continue;
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, watch->fd, nullptr);
+      watch = nullptr;
+    }
   }
 
   {
-    std::unique_lock<std::mutex> guard(timeout_mutex_);
-    timeout_cb_ = nullptr;
+    std::unique_lock<std::mutex> guard(timer_mutex_);
+    timers_.clear();
+    deadlines_.clear();
+    timeout_timer_ = 0;
+    armTimerFd();
   }
 
   return 0;
 }
 
 int AsyncFdWatcher::notifyThread() {
-  uint8_t buffer[] = {0};
-  if (TEMP_FAILURE_RETRY(write(notification_write_fd_, &buffer, 1)) < 0) {
+  uint64_t value = 1;
+  if (TEMP_FAILURE_RETRY(write(notification_fd_, &value, sizeof(value))) < 0) {
     return -1;
   }
   return 0;
 }
 
 void AsyncFdWatcher::ThreadRoutine() {
-  while (running_) {
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    FD_SET(notification_listen_fd_, &read_fds);
-    int max_read_fd = INVALID_FD;
-    for (auto& it : watched_fds_) {
-      FD_SET(it.first, &read_fds);
-      max_read_fd = std::max(max_read_fd, it.first);
-    }
-
-    struct timeval timeout;
-    struct timeval* timeout_ptr = NULL;
-    if (timeout_ms_ > std::chrono::milliseconds(0)) {
-      timeout.tv_sec = timeout_ms_.count() / 1000;
-      timeout.tv_usec = (timeout_ms_.count() % 1000) * 1000;
-      timeout_ptr = &timeout;
-    }
+  struct epoll_event events[kMaxEventsPerWakeup];
 
-    // Wait until there is data available to read on some FD.
-    int nfds = std::max(notification_listen_fd_, max_read_fd);
-    int retval = select(nfds + 1, &read_fds, NULL, NULL, timeout_ptr);
+  while (running_) {
+    // Wait until there is data available to read on some FD or a timer
+    // expires.
+    int nfds = epoll_wait(epoll_fd_, events, kMaxEventsPerWakeup, -1);
 
     // There was some error.
-    if (retval < 0) continue;
+    if (nfds < 0) continue;
 
-    // Timeout.
-    if (retval == 0) {
-      // Allow the timeout callback to modify the timeout.
-      TimeoutCallback saved_cb;
-      {
-        std::unique_lock<std::mutex> guard(timeout_mutex_);
-        if (timeout_ms_ > std::chrono::milliseconds(0)) saved_cb = timeout_cb_;
-      }
-      if (saved_cb != nullptr) saved_cb();
-      continue;
-    }
+    // Invoke the ready callbacks, only visiting the ready descriptors.
+    for (int i = 0; i < nfds && running_; i++) {
+      uint32_t index = events[i].data.u32;
 
-    // Read data from the notification FD.
-    if (FD_ISSET(notification_listen_fd_, &read_fds)) {
-      char buffer[] = {0};
-      TEMP_FAILURE_RETRY(read(notification_listen_fd_, buffer, 1));
-      continue;
-    }
+      if (index == kNotificationIndex) {
+        uint64_t value;
+        TEMP_FAILURE_RETRY(read(notification_fd_, &value, sizeof(value)));
+        continue;
+      }
 
-    // Invoke the data ready callbacks if appropriate.
-    std::vector<decltype(watched_fds_)::value_type> saved_callbacks;
-    {
-      std::unique_lock<std::mutex> guard(internal_mutex_);
-      for (auto& it : watched_fds_) {
-        if (FD_ISSET(it.first, &read_fds)) {
-          saved_callbacks.push_back(it);
-        }
+      if (index == kTimerIndex) {
+        runExpiredTimers();
+        continue;
       }
-    }
 
-    for (auto& it : saved_callbacks) {
-      if (it.second) {
-        it.second(it.first);
+      // Hold a reference so the callback survives a concurrent re-register.
+      std::shared_ptr<const Watch> watch;
+      {
+        std::unique_lock<std::mutex> guard(internal_mutex_);
+        watch = watches_[index];
+      }
+      if (watch == nullptr) continue;
+      if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+          watch->on_read_fd_ready) {
+        watch->on_read_fd_ready(watch->fd);
+      }
+      if ((events[i].events & (EPOLLOUT | EPOLLERR)) &&
+          watch->on_write_fd_ready) {
+        watch->on_write_fd_ready(watch->fd);
       }
     }
   }
@@ -16,9 +16,15 @@
 
 #pragma once
 
-#include <map>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace android {
 namespace hardware {
@@ -26,38 +32,105 @@ namespace bluetooth {
 namespace async {
 
 using ReadCallback = std::function<void(int)>;
+using WriteCallback = std::function<void(int)>;
 using TimeoutCallback = std::function<void(void)>;
+using TimerCallback = std::function<void(void)>;
+using TimerClock = std::chrono::steady_clock;
+using TimerId = uint32_t;
 
 class AsyncFdWatcher {
  public:
-  AsyncFdWatcher() = default;
+  AsyncFdWatcher();
   ~AsyncFdWatcher();
 
+  // Edge-triggered watches are only reported when new data arrives, so their
+  // callback has to consume everything that is available on each call.
   int WatchFdForNonBlockingReads(int file_descriptor,
-                                 const ReadCallback& on_read_fd_ready_callback);
+                                 const ReadCallback& on_read_fd_ready_callback,
+                                 bool edge_triggered = false);
+  // Adds write readiness to the registration of file_descriptor, a null
+  // callback removes it, so it can be enabled only while output is pending.
+  // The trigger mode applies to reads and writes of the fd alike: it is set
+  // by the first watch of the fd, and a later call asking for the other mode
+  // fails. Either way the callback runs once right after it is added if the
+  // fd is already writable; level-triggered, it then runs for as long as it
+  // stays so.
+  int WatchFdForWrites(int file_descriptor,
+                       const WriteCallback& on_write_fd_ready_callback,
+                       bool edge_triggered = false);
+  // Calls on_timeout_callback every timeout, a zero timeout stops it.
   int ConfigureTimeout(const std::chrono::milliseconds timeout,
                        const TimeoutCallback& on_timeout_callback);
   void StopWatchingFileDescriptors();
 
+  // Timers run on the watcher thread. Deadlines are absolute, so a periodic
+  // timer fires at deadline + n * period however long its callbacks take;
+  // periods that are missed entirely are skipped. Returns 0 on failure.
+  TimerId ScheduleTimer(TimerClock::time_point deadline,
+                        const TimerCallback& on_timer_callback,
+                        TimerClock::duration period = TimerClock::duration(0));
+  TimerId ScheduleTimer(TimerClock::duration delay,
+                        const TimerCallback& on_timer_callback,
+                        bool periodic = false);
+  // A callback that is already running completes, but does not run again.
+  bool CancelTimer(TimerId id);
+
  private:
   AsyncFdWatcher(const AsyncFdWatcher&) = delete;
   AsyncFdWatcher& operator=(const AsyncFdWatcher&) = delete;
 
+  // Registrations live in a fixed table; the epoll data of a watched fd is
+  // its index in that table.
+  static const size_t kMaxWatchedFds = 8;
+  static const size_t kMaxEventsPerWakeup = kMaxWatchedFds + 2;
+  static const uint32_t kNotificationIndex = kMaxWatchedFds;
+  static const uint32_t kTimerIndex = kMaxWatchedFds + 1;
+
+  struct Watch {
+    int fd;
+    ReadCallback on_read_fd_ready;
+    WriteCallback on_write_fd_ready;
+    bool edge_triggered;
+  };
+
+  struct Timer {
+    TimerClock::duration period;
+    TimerCallback on_timer;
+  };
+
+  // Timers are kept in a min-heap of deadlines. Cancelled timers are only
+  // removed from timers_, their heap entries are skipped when they expire.
+  struct Deadline {
+    TimerClock::time_point when;
+    TimerId id;
+    bool operator<(const Deadline& other) const { return when > other.when; }
+  };
+
+  // Registers or updates the watch of file_descriptor. Null callback
+  // pointers keep what is already registered.
+  int updateWatch(int file_descriptor, const ReadCallback* on_read,
+                  const WriteCallback* on_write, bool edge_triggered);
   int tryStartThread();
   int stopThread();
   int notifyThread();
   void ThreadRoutine();
+  void armTimerFd();
+  void runExpiredTimers();
 
   std::atomic_bool running_{false};
   std::thread thread_;
   std::mutex internal_mutex_;
-  std::mutex timeout_mutex_;
+  std::mutex timer_mutex_;
+
+  std::array<std::shared_ptr<const Watch>, kMaxWatchedFds> watches_;
+  int epoll_fd_;
+  int notification_fd_;
+  int timer_fd_;
 
-  std::map<int, ReadCallback> watched_fds_;
-  int notification_listen_fd_;
-  int notification_write_fd_;
-  TimeoutCallback timeout_cb_;
-  std::chrono::milliseconds timeout_ms_;
+  std::vector<Deadline> deadlines_;
+  std::unordered_map<TimerId, Timer> timers_;
+  TimerId next_timer_id_{1};
+  TimerId timeout_timer_{0};
 };
 
 }  // namespace async
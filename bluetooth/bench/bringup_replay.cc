@@ -0,0 +1,297 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Turns the bt_bringup markers of uim and the HAL into Bluetooth bring-up
+// timelines, one per boot.
+//
+// The markers are picked out of whatever is given, logcat output or a trace. A
+// boot ends where the monotonic clock goes back. Boots found in several files,
+// such as the log and the trace of the same boots, are counted once.
+// Concatenated captures only split cleanly when they hold a single boot, so
+// pass several boots' worth as separate files.
+//
+// A bring-up runs from the HAL initialize mark to initialization complete. The
+// summary gives the time to ready over all bring-ups and each phase's offset
+// from initialize, so the phase that regressed stands out. With -l, the exit
+// status is 2 when a bring-up took longer than the limit.
+//
+//   hikey_bt_bringup_replay [-l limit_ms] [file...]
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+const char* kTag = "bt_bringup";
+const char* kHalSource = "hal";
+const char* kStartPhase = "initialize";
+const char* kReadyPhase = "initialization complete";
+const char* kFailedPhase = "initialization failed";
+// Marks of one boot may be logged slightly out of order, a reboot sets the
+// clock back by much more.
+const int64_t kBootGapNs = 1000000000LL;
+
+struct Mark {
+  std::string source;
+  int64_t t;
+  std::string phase;
+
+  bool Is(const char* s, const char* p) const {
+    return source == s && phase == p;
+  }
+  bool operator<(const Mark& other) const {
+    return std::tie(t, source, phase) <
+           std::tie(other.t, other.source, other.phase);
+  }
+};
+
+struct BringUp {
+  int64_t start_ns;
+  int64_t ready_ns;  // 0 while not ready
+  bool failed;
+  bool first_of_boot;
+};
+
+double Ms(int64_t ns) { return ns / 1e6; }
+
+// Parses "... bt_bringup...source=<source> t=<ns> phase=<phase>".
+bool ParseMark(const std::string& line, Mark* mark) {
+  size_t tag = line.find(kTag);
+  if (tag == std::string::npos) return false;
+  size_t source = line.find("source=", tag);
+  size_t t = line.find(" t=", tag);
+  size_t phase = line.find(" phase=", tag);
+  if (source == std::string::npos || t == std::string::npos ||
+      phase == std::string::npos || !(source < t && t < phase))
+    return false;
+
+  mark->source = line.substr(source + 7, t - source - 7);
+  char* end;
+  mark->t = strtoll(line.c_str() + t + 3, &end, 10);
+  if (end != line.c_str() + phase) return false;
+  mark->phase = line.substr(phase + 7);
+  while (!mark->phase.empty() && isspace(mark->phase.back()))
+    mark->phase.pop_back();
+  return !mark->source.empty() && !mark->phase.empty();
+}
+
+void ReadMarks(FILE* in, std::vector<Mark>* marks) {
+  char* line = nullptr;
+  size_t size = 0;
+  Mark mark;
+  while (getline(&line, &size, in) > 0) {
+    if (ParseMark(line, &mark)) marks->push_back(mark);
+  }
+  free(line);
+}
+
+// Splits the marks of one input into boots, in the order they were read.
+std::vector<std::vector<Mark>> SplitBoots(const std::vector<Mark>& marks) {
+  std::vector<std::vector<Mark>> boots;
+  int64_t last = 0;
+  for (const Mark& mark : marks) {
+    if (boots.empty() || mark.t + kBootGapNs < last) {
+      boots.emplace_back();
+      last = mark.t;
+    }
+    boots.back().push_back(mark);
+    last = std::max(last, mark.t);
+  }
+  return boots;
+}
+
+// Puts the marks of a boot in time order, without duplicates.
+void SortBoot(std::vector<Mark>* boot) {
+  std::sort(boot->begin(), boot->end());
+  boot->erase(std::unique(boot->begin(), boot->end(),
+                          [](const Mark& a, const Mark& b) {
+                            return !(a < b) && !(b < a);
+                          }),
+              boot->end());
+}
+
+// Whether two sorted boots have a mark in common.
+bool SharesMark(const std::vector<Mark>& a, const std::vector<Mark>& b) {
+  auto i = a.begin(), j = b.begin();
+  while (i != a.end() && j != b.end()) {
+    if (*i < *j)
+      ++i;
+    else if (*j < *i)
+      ++j;
+    else
+      return true;
+  }
+  return false;
+}
+
+// Adds the boots of one input to boots. The log and the trace of a boot
+// carry the same marks, so a boot sharing a mark with one added before is
+// merged into it rather than counted again.
+void AddBoots(std::vector<std::vector<Mark>> input,
+              std::vector<std::vector<Mark>>* boots) {
+  for (std::vector<Mark>& boot : input) {
+    SortBoot(&boot);
+    auto same = std::find_if(boots->begin(), boots->end(),
+                             [&boot](const std::vector<Mark>& other) {
+                               return SharesMark(boot, other);
+                             });
+    if (same == boots->end()) {
+      boots->push_back(std::move(boot));
+      continue;
+    }
+    same->insert(same->end(), boot.begin(), boot.end());
+    SortBoot(&*same);
+  }
+}
+
+std::vector<BringUp> PrintBoot(size_t index, const std::vector<Mark>& boot) {
+  std::vector<BringUp> bring_ups;
+  printf("boot %zu: %zu marks\n", index, boot.size());
+  printf("  %12s %12s %12s  %-6s %s\n", "since boot", "from start", "delta",
+         "source", "phase");
+
+  int64_t start = boot.front().t;
+  int64_t previous = start;
+  for (const Mark& mark : boot) {
+    if (mark.Is(kHalSource, kStartPhase)) {
+      start = mark.t;
+      bring_ups.push_back(BringUp{mark.t, 0, false, bring_ups.empty()});
+    }
+    printf("  %9.3f ms %+9.3f ms %+9.3f ms  %-6s %s\n", Ms(mark.t),
+           Ms(mark.t - start), Ms(mark.t - previous), mark.source.c_str(),
+           mark.phase.c_str());
+    previous = mark.t;
+
+    if (bring_ups.empty() || bring_ups.back().ready_ns != 0 ||
+        bring_ups.back().failed)
+      continue;
+    BringUp& bring_up = bring_ups.back();
+    if (mark.Is(kHalSource, kReadyPhase)) {
+      bring_up.ready_ns = mark.t;
+      printf("  ready %.3f ms after initialize, %.3f ms after boot\n",
+             Ms(mark.t - bring_up.start_ns), Ms(mark.t));
+    } else if (mark.Is(kHalSource, kFailedPhase)) {
+      bring_up.failed = true;
+      printf("  failed %.3f ms after initialize\n",
+             Ms(mark.t - bring_up.start_ns));
+    }
+  }
+  printf("\n");
+  return bring_ups;
+}
+
+void PrintDistribution(const char* what, std::vector<int64_t> values) {
+  if (values.empty()) return;
+  std::sort(values.begin(), values.end());
+  printf("%-40s p50 %9.3f ms  max %9.3f ms  (%zu)\n", what,
+         Ms(values[values.size() / 2]), Ms(values.back()), values.size());
+}
+
+void Usage(const char* name) {
+  fprintf(stderr, "Usage: %s [-l limit_ms] [file...]\n", name);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  double limit_ms = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "l:h")) != -1) {
+    switch (opt) {
+      case 'l':
+        limit_ms = atof(optarg);
+        break;
+      default:
+        Usage(argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<std::vector<Mark>> boots;
+  std::vector<Mark> marks;
+  if (optind == argc) {
+    ReadMarks(stdin, &marks);
+    AddBoots(SplitBoots(marks), &boots);
+  }
+  for (int i = optind; i < argc; i++) {
+    FILE* in = fopen(argv[i], "r");
+    if (in == nullptr) {
+      fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+      return 1;
+    }
+    marks.clear();
+    ReadMarks(in, &marks);
+    fclose(in);
+    AddBoots(SplitBoots(marks), &boots);
+  }
+  if (boots.empty()) {
+    fprintf(stderr, "no %s markers found\n", kTag);
+    return 1;
+  }
+
+  std::vector<int64_t> ready, ready_since_boot;
+  // Offset of each phase from the initialize mark of its bring-up.
+  std::map<std::string, std::vector<int64_t>> phases;
+  size_t total = 0, failed = 0, over_limit = 0;
+  for (size_t i = 0; i < boots.size(); i++) {
+    std::vector<BringUp> bring_ups = PrintBoot(i + 1, boots[i]);
+    for (const BringUp& bring_up : bring_ups) {
+      total++;
+      if (bring_up.failed) failed++;
+      if (bring_up.ready_ns == 0) continue;
+      int64_t took = bring_up.ready_ns - bring_up.start_ns;
+      ready.push_back(took);
+      if (bring_up.first_of_boot) ready_since_boot.push_back(bring_up.ready_ns);
+      if (limit_ms > 0 && Ms(took) > limit_ms) over_limit++;
+      for (const Mark& mark : boots[i]) {
+        if (mark.t < bring_up.start_ns || mark.t > bring_up.ready_ns) continue;
+        phases[mark.source + " " + mark.phase].push_back(mark.t -
+                                                        bring_up.start_ns);
+      }
+    }
+  }
+
+  printf("%zu bring-ups over %zu boots, %zu failed, %zu not finished\n", total,
+         boots.size(), failed, total - failed - ready.size());
+  PrintDistribution("ready after initialize", ready);
+  PrintDistribution("ready after boot (first bring-up)", ready_since_boot);
+  if (!phases.empty()) printf("phase offsets from initialize:\n");
+  std::vector<std::pair<int64_t, std::string>> order;
+  for (auto& phase : phases) {
+    std::vector<int64_t>& offsets = phase.second;
+    std::sort(offsets.begin(), offsets.end());
+    order.emplace_back(offsets[offsets.size() / 2], phase.first);
+  }
+  std::sort(order.begin(), order.end());
+  for (auto& phase : order)
+    PrintDistribution(("  " + phase.second).c_str(), phases[phase.second]);
+
+  if (over_limit > 0) {
+    printf("%zu bring-ups over the %.3f ms limit\n", over_limit, limit_ms);
+    return 2;
+  }
+  return 0;
+}
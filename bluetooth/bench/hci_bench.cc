@@ -0,0 +1,394 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+// Measures the HCI transport against a fake controller on a pseudo-terminal.
+//
+// The controller end of the pty plays back a traffic pattern while the HAL
+// end runs the real AsyncFdWatcher, H4Protocol, dispatcher and SCO lane.
+// Every received packet carries the time it was written to the pty, which
+// gives the write-to-callback latency. Reports packets/s, bytes/s, CPU time
+// per packet outside the controller thread and latency percentiles.
+// The large scenario cycles through ACL lengths above the WL18xx buffer size
+// up to the 16-bit limit, as a controller with larger buffers would send.
+//
+//   hikey_hci_bench -s events|acl|large|sco|mixed|tx [-n packets]
+//                   [-l acl_length] [-j sco_jitter_depth]
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "async_fd_watcher.h"
+#include "h4_protocol.h"
+
+using android::hardware::bluetooth::async::AsyncFdWatcher;
+using android::hardware::bluetooth::async::WriteCallback;
+using android::hardware::bluetooth::hci::H4Protocol;
+using android::hardware::hidl_vec;
+
+namespace {
+
+const size_t kDefaultAclLength = 1021;  // WL18xx ACL buffer size
+const size_t kScoLength = 60;
+const int64_t kScoIntervalNs = 7500000;
+const uint16_t kAclHandle = 0x0001;
+const uint16_t kScoHandle = 0x0006;
+const size_t kLargeAclLengths[] = {1022, 2048, 4096, 8192, 16384, 0xFFFF};
+
+enum Scenario { EVENTS, ACL, LARGE, SCO, MIXED, TX };
+
+struct Options {
+  Scenario scenario = ACL;
+  size_t count = 10000;
+  size_t acl_length = kDefaultAclLength;
+  size_t sco_jitter_depth = 0;
+};
+
+int64_t NowNs(clockid_t clock = CLOCK_MONOTONIC) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int64_t ProcessCpuNs() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+}
+
+void WriteAll(int fd, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    ssize_t ret = TEMP_FAILURE_RETRY(write(fd, data, length));
+    if (ret <= 0) {
+      fprintf(stderr, "controller write failed: %s\n", strerror(errno));
+      exit(1);
+    }
+    data += ret;
+    length -= ret;
+  }
+}
+
+// Collects what the HAL delivers.
+class Sink {
+ public:
+  void OnPacket(const hidl_vec<uint8_t>& packet, size_t stamp_offset) {
+    int64_t now = NowNs();
+    int64_t sent = 0;
+    if (packet.size() >= stamp_offset + sizeof(sent))
+      memcpy(&sent, packet.data() + stamp_offset, sizeof(sent));
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (sent != 0) latencies_.push_back(now - sent);
+    bytes_ += packet.size();
+    if (++packets_ >= expected_) done_.notify_all();
+  }
+
+  bool Wait(size_t expected, std::chrono::seconds timeout) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    expected_ = expected;
+    return done_.wait_for(guard, timeout,
+                          [this] { return packets_ >= expected_; });
+  }
+
+  size_t packets() const { return packets_; }
+  size_t bytes() const { return bytes_; }
+  std::vector<int64_t>& latencies() { return latencies_; }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable done_;
+  size_t expected_{0};
+  size_t packets_{0};
+  size_t bytes_{0};
+  std::vector<int64_t> latencies_;
+};
+
+// Packets are built with the send time right after their preamble.
+std::vector<uint8_t> EventFrame() {
+  // Command Complete for HCI_Reset with the timestamp as extra parameters.
+  std::vector<uint8_t> frame = {HCI_PACKET_TYPE_EVENT, HCI_COMMAND_COMPLETE_EVENT,
+                                0, 1, 0x03, 0x0c, 0x00};
+  frame.resize(frame.size() + sizeof(int64_t));
+  frame[2] = frame.size() - 1 - HCI_EVENT_PREAMBLE_SIZE;
+  return frame;
+}
+
+std::vector<uint8_t> AclFrame(size_t length) {
+  std::vector<uint8_t> frame(1 + HCI_ACL_PREAMBLE_SIZE + length);
+  frame[0] = HCI_PACKET_TYPE_ACL_DATA;
+  frame[1] = kAclHandle & 0xff;
+  frame[2] = (kAclHandle >> 8) | 0x20;
+  frame[3] = length & 0xff;
+  frame[4] = length >> 8;
+  return frame;
+}
+
+std::vector<uint8_t> ScoFrame() {
+  std::vector<uint8_t> frame(1 + HCI_SCO_PREAMBLE_SIZE + kScoLength);
+  frame[0] = HCI_PACKET_TYPE_SCO_DATA;
+  frame[1] = kScoHandle & 0xff;
+  frame[2] = kScoHandle >> 8;
+  frame[3] = kScoLength;
+  return frame;
+}
+
+void Stamp(std::vector<uint8_t>& frame, size_t offset) {
+  int64_t now = NowNs();
+  memcpy(frame.data() + offset, &now, sizeof(now));
+}
+
+// Offsets of the timestamp within the delivered packets (no type byte).
+const size_t kEventStampOffset = HCI_EVENT_PREAMBLE_SIZE + 4;
+const size_t kAclStampOffset = HCI_ACL_PREAMBLE_SIZE;
+const size_t kScoStampOffset = HCI_SCO_PREAMBLE_SIZE;
+
+void PlayScoAt(int fd, size_t count, std::atomic_bool* stop) {
+  std::vector<uint8_t> frame = ScoFrame();
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (size_t i = 0; i < count && !*stop; i++) {
+    Stamp(frame, 1 + kScoStampOffset);
+    WriteAll(fd, frame.data(), frame.size());
+    next.tv_nsec += kScoIntervalNs;
+    if (next.tv_nsec >= 1000000000L) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000L;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+  }
+}
+
+void Report(const char* name, Sink& sink, int64_t elapsed_ns, int64_t cpu_ns) {
+  std::vector<int64_t>& latencies = sink.latencies();
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](size_t p) -> long long {
+    if (latencies.empty()) return 0;
+    return latencies[(latencies.size() - 1) * p / 100] / 1000;
+  };
+
+  double seconds = elapsed_ns / 1e9;
+  printf("%s: %zu packets, %zu bytes in %.3f s\n", name, sink.packets(),
+         sink.bytes(), seconds);
+  printf("  %.0f packets/s, %.2f MB/s, %.2f us CPU/packet\n",
+         sink.packets() / seconds, sink.bytes() / seconds / 1e6,
+         sink.packets() ? cpu_ns / 1e3 / sink.packets() : 0.0);
+  if (!latencies.empty())
+    printf("  write-to-callback latency: p50=%lld us p90=%lld us p99=%lld us "
+           "max=%lld us\n",
+           percentile(50), percentile(90), percentile(99),
+           static_cast<long long>(latencies.back() / 1000));
+}
+
+// The HAL sends ACL frames; the controller end counts what arrives. The
+// frames are sent before their buffer counts are known, so flow control
+// passes them straight through.
+int RunTx(int controller_fd, H4Protocol& hci, const Options& options) {
+  size_t frame_size = 1 + HCI_ACL_PREAMBLE_SIZE + options.acl_length;
+  size_t expected = frame_size * options.count;
+  std::atomic<size_t> received{0};
+  std::thread drain([controller_fd, expected, &received] {
+    std::vector<uint8_t> buffer(65536);
+    while (received < expected) {
+      ssize_t ret = read(controller_fd, buffer.data(), buffer.size());
+      if (ret <= 0) break;
+      received += ret;
+    }
+  });
+
+  std::vector<uint8_t> frame = AclFrame(options.acl_length);
+  int64_t cpu = ProcessCpuNs();
+  int64_t start = NowNs();
+  for (size_t i = 0; i < options.count; i++)
+    hci.Send(HCI_PACKET_TYPE_ACL_DATA, frame.data() + 1, frame.size() - 1);
+  drain.join();
+  int64_t elapsed = NowNs() - start;
+  cpu = ProcessCpuNs() - cpu;
+
+  double seconds = elapsed / 1e9;
+  printf("tx: %zu frames, %zu bytes in %.3f s\n", options.count,
+         received.load(), seconds);
+  printf("  %.0f frames/s, %.2f MB/s, %.2f us CPU/frame\n",
+         options.count / seconds, received / seconds / 1e6,
+         cpu / 1e3 / options.count);
+  return received == expected ? 0 : 1;
+}
+
+void Usage(const char* name) {
+  fprintf(stderr,
+          "Usage: %s [-s events|acl|large|sco|mixed|tx] [-n packets]"
+          " [-l acl_length]"
+          " [-j sco_jitter_depth]\n",
+          name);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:n:l:j:h")) != -1) {
+    switch (opt) {
+      case 's': {
+        std::string name = optarg;
+        if (name == "events") options.scenario = EVENTS;
+        else if (name == "acl") options.scenario = ACL;
+        else if (name == "large") options.scenario = LARGE;
+        else if (name == "sco") options.scenario = SCO;
+        else if (name == "mixed") options.scenario = MIXED;
+        else if (name == "tx") options.scenario = TX;
+        else {
+          Usage(argv[0]);
+          return 1;
+        }
+        break;
+      }
+      case 'n':
+        options.count = strtoul(optarg, nullptr, 0);
+        break;
+      case 'l':
+        options.acl_length = std::min(strtoul(optarg, nullptr, 0), 0xFFFFUL);
+        break;
+      case 'j':
+        options.sco_jitter_depth = strtoul(optarg, nullptr, 0);
+        break;
+      default:
+        Usage(argv[0]);
+        return 1;
+    }
+  }
+  if (options.count == 0 || options.acl_length < sizeof(int64_t)) {
+    Usage(argv[0]);
+    return 1;
+  }
+
+  // The controller end is the pty master, the HAL end the raw slave.
+  int controller_fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (controller_fd < 0 || grantpt(controller_fd) || unlockpt(controller_fd)) {
+    fprintf(stderr, "can't create a pty: %s\n", strerror(errno));
+    return 1;
+  }
+  int hal_fd = open(ptsname(controller_fd), O_RDWR | O_NOCTTY);
+  struct termios tio;
+  if (hal_fd < 0 || tcgetattr(hal_fd, &tio)) {
+    fprintf(stderr, "can't open the pty slave: %s\n", strerror(errno));
+    return 1;
+  }
+  cfmakeraw(&tio);
+  tcsetattr(hal_fd, TCSANOW, &tio);
+
+  Sink sink;
+  H4Protocol hci(
+      hal_fd,
+      [&sink](const hidl_vec<uint8_t>& p) { sink.OnPacket(p, kEventStampOffset); },
+      [&sink](const hidl_vec<uint8_t>& p) { sink.OnPacket(p, kAclStampOffset); },
+      [&sink](const hidl_vec<uint8_t>& p) { sink.OnPacket(p, kScoStampOffset); },
+      options.sco_jitter_depth);
+  AsyncFdWatcher watcher;
+  watcher.WatchFdForNonBlockingReads(
+      hal_fd, [&hci](int fd) { hci.OnDataReady(fd); }, true);
+  // As in BluetoothHci::initialize, writability is only watched while
+  // frames are queued.
+  hci.SetWriteWatch([&watcher, &hci, hal_fd](bool enable) {
+    watcher.WatchFdForWrites(
+        hal_fd,
+        enable ? WriteCallback([&hci](int fd) { hci.OnWriteReady(fd); })
+               : WriteCallback(),
+        true);
+  });
+
+  int ret = 0;
+  if (options.scenario == TX) {
+    ret = RunTx(controller_fd, hci, options);
+  } else {
+    size_t expected = options.count;
+    std::atomic_bool stop{false};
+    int64_t controller_cpu = 0;
+    int64_t cpu = ProcessCpuNs();
+    int64_t start = NowNs();
+
+    std::thread controller([&] {
+      int64_t thread_cpu = NowNs(CLOCK_THREAD_CPUTIME_ID);
+      if (options.scenario == EVENTS) {
+        std::vector<uint8_t> frame = EventFrame();
+        for (size_t i = 0; i < options.count && !stop; i++) {
+          Stamp(frame, 1 + kEventStampOffset);
+          WriteAll(controller_fd, frame.data(), frame.size());
+        }
+      } else if (options.scenario == ACL) {
+        std::vector<uint8_t> frame = AclFrame(options.acl_length);
+        for (size_t i = 0; i < options.count && !stop; i++) {
+          Stamp(frame, 1 + kAclStampOffset);
+          WriteAll(controller_fd, frame.data(), frame.size());
+        }
+      } else if (options.scenario == LARGE) {
+        std::vector<std::vector<uint8_t>> frames;
+        for (size_t length : kLargeAclLengths)
+          frames.push_back(AclFrame(length));
+        for (size_t i = 0; i < options.count && !stop; i++) {
+          std::vector<uint8_t>& frame = frames[i % frames.size()];
+          Stamp(frame, 1 + kAclStampOffset);
+          WriteAll(controller_fd, frame.data(), frame.size());
+        }
+      } else if (options.scenario == SCO) {
+        PlayScoAt(controller_fd, options.count, &stop);
+      } else {
+        // Voice at its own pace while ACL is streamed as fast as possible.
+        size_t sco_count = options.count / 10;
+        std::thread sco(PlayScoAt, controller_fd, sco_count, &stop);
+        std::vector<uint8_t> frame = AclFrame(options.acl_length);
+        for (size_t i = 0; i < options.count - sco_count && !stop; i++) {
+          Stamp(frame, 1 + kAclStampOffset);
+          WriteAll(controller_fd, frame.data(), frame.size());
+        }
+        sco.join();
+      }
+      controller_cpu = NowNs(CLOCK_THREAD_CPUTIME_ID) - thread_cpu;
+    });
+
+    if (!sink.Wait(expected, std::chrono::seconds(60))) {
+      fprintf(stderr, "timed out with %zu of %zu packets\n", sink.packets(),
+              expected);
+      ret = 1;
+    }
+    int64_t elapsed = NowNs() - start;
+    stop = true;
+    controller.join();
+    cpu = ProcessCpuNs() - cpu - controller_cpu;
+
+    const char* names[] = {"events", "acl", "large", "sco", "mixed"};
+    Report(names[options.scenario], sink, elapsed, cpu);
+  }
+
+  hci.SetWriteWatch(nullptr);
+  watcher.StopWatchingFileDescriptors();
+  close(hal_fd);
+  close(controller_fd);
+  return ret;
+}
@@ -19,8 +19,8 @@
 #include "bluetooth_hci.h"
 
 #include <android-base/logging.h>
-#include <sys/ioctl.h>
-#include <sys/socket.h>
+#include <bt_bringup_trace.h>
+#include <cutils/properties.h>
 #include <unistd.h>
 #include <utils/Log.h>
 
@@ -32,19 +32,32 @@ namespace hikey {
 
 using android::hardware::hidl_vec;
 
+// Received SCO packets buffered before delivery to absorb UART bursts.
+static const char* kScoJitterDepthProperty = "bluetooth.hikey.sco_jitter_depth";
+static const int32_t kDefaultScoJitterDepth = 2;
+// Capture HCI traffic into a ring that can be dumped with lshal debug.
+static const char* kSnoopProperty = "bluetooth.hikey.snoop";
+// Source of the bring-up markers, which uim shares.
+static const char* kBringupSource = "hal";
+
 BluetoothHci::BluetoothHci()
     : deathRecipient(new BluetoothDeathRecipient(this)) {}
 
 Return<void> BluetoothHci::initialize(
     const ::android::sp<IBluetoothHciCallbacks>& cb) {
   ALOGI("BluetoothHci::initialize()");
+  bt_bringup_mark(kBringupSource, "initialize");
 
+  // Opening the tty has the shared transport driver ask uim for the line
+  // discipline, so the uim marks land between these two.
   hci_tty_fd_ = open("/dev/hci_tty", O_RDWR);
   if (hci_tty_fd_ < 0) {
     ALOGE("%s: Can't open hci_tty (%s)", __func__, strerror(errno));
+    bt_bringup_mark(kBringupSource, "initialization failed");
     cb->initializationComplete(Status::INITIALIZATION_ERROR);
     return Void();
   }
+  bt_bringup_mark(kBringupSource, "hci_tty opened");
 
   event_cb_ = cb;
   event_cb_->linkToDeath(deathRecipient, 0);
@@ -53,52 +66,74 @@ Return<void> BluetoothHci::initialize(
       hci_tty_fd_,
       [cb](const hidl_vec<uint8_t>& packet) { cb->hciEventReceived(packet); },
       [cb](const hidl_vec<uint8_t>& packet) { cb->aclDataReceived(packet); },
-      [cb](const hidl_vec<uint8_t>& packet) { cb->scoDataReceived(packet); });
-
-  // Use a socket pair to enforce the TI FIONREAD requirement.
-  int sockfd[2];
-  socketpair(AF_LOCAL, SOCK_STREAM, 0, sockfd);
-  int shim_fd = sockfd[0];
-  int for_hci = sockfd[1];
-
-  fd_watcher_.WatchFdForNonBlockingReads(hci_tty_fd_, [this, shim_fd](int fd) {
-    int tty_bytes = 0;
-    if (TEMP_FAILURE_RETRY(ioctl(fd, FIONREAD, &tty_bytes)))
-      ALOGE("%s:FIONREAD %s", __func__, strerror(errno));
-    ALOGV("%s:tty_bytes = %d", __func__, tty_bytes);
-
-    uint8_t* tmp_buffer = new uint8_t[tty_bytes];
-    size_t bytes_read = TEMP_FAILURE_RETRY(read(fd, tmp_buffer, tty_bytes));
-    CHECK(static_cast<int>(bytes_read) == tty_bytes);
-    size_t bytes_written =
-        TEMP_FAILURE_RETRY(write(shim_fd, tmp_buffer, tty_bytes));
-    CHECK(static_cast<int>(bytes_written) == tty_bytes);
-    delete[] tmp_buffer;
-  });
+      [cb](const hidl_vec<uint8_t>& packet) { cb->scoDataReceived(packet); },
+      property_get_int32(kScoJitterDepthProperty, kDefaultScoJitterDepth));
+
+  if (snoop_ == nullptr && property_get_bool(kSnoopProperty, false))
+    snoop_.reset(new hci::BtsnoopRing());
+  hci_->SetSnoop(snoop_.get());
 
   fd_watcher_.WatchFdForNonBlockingReads(
-      for_hci, [this](int fd) { hci_->OnDataReady(fd); });
+      hci_tty_fd_, [this](int fd) { hci_->OnDataReady(fd); },
+      true /* edge_triggered */);
+  // Frames the tty does not take right away are written from the watcher,
+  // which only waits for the tty to be writable while some are queued.
+  hci_->SetWriteWatch([this](bool enable) {
+    fd_watcher_.WatchFdForWrites(
+        hci_tty_fd_,
+        enable ? async::WriteCallback(
+                     [this](int fd) { hci_->OnWriteReady(fd); })
+               : async::WriteCallback(),
+        true /* edge_triggered */);
+  });
 
   cb->initializationComplete(Status::SUCCESS);
+  bt_bringup_mark(kBringupSource, "initialization complete");
   return Void();
 }
 
 Return<void> BluetoothHci::close() {
   ALOGI("BluetoothHci::close()");
+  bt_bringup_mark(kBringupSource, "close");
 
+  if (hci_ != nullptr) hci_->SetWriteWatch(nullptr);
   if (hci_tty_fd_ >= 0) {
     fd_watcher_.StopWatchingFileDescriptors();
-    ::close(hci_tty_fd_);
-    hci_tty_fd_ = -1;
   }
 
   event_cb_->unlinkToDeath(deathRecipient);
 
+  // Deleting the protocol writes out what is still queued, so do it before
+  // the tty goes away.
   if (hci_ != nullptr) {
     delete hci_;
     hci_ = nullptr;
   }
 
+  if (hci_tty_fd_ >= 0) {
+    ::close(hci_tty_fd_);
+    hci_tty_fd_ = -1;
+  }
+
+  return Void();
+}
+
+Return<void> BluetoothHci::debug(const hidl_handle& handle,
+                                 const hidl_vec<hidl_string>& options) {
+  const native_handle_t* native = handle.getNativeHandle();
+  if (native == nullptr || native->numFds < 1) return Void();
+  int fd = native->data[0];
+
+  if (snoop_ == nullptr) {
+    dprintf(fd, "HCI capture is off, set %s=true and restart Bluetooth\n",
+            kSnoopProperty);
+  } else if (options.size() > 0 && options[0] == "snoop") {
+    snoop_->Dump(fd);
+  } else {
+    dprintf(fd, "HCI capture: %zu packets captured, the last %zu are kept\n",
+            snoop_->Captured(), snoop_->RecordCount());
+    dprintf(fd, "Pass the snoop option to get them as a btsnoop file\n");
+  }
   return Void();
 }
 
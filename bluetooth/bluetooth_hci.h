@@ -20,7 +20,10 @@
 
 #include <hidl/MQDescriptor.h>
 
+#include <memory>
+
 #include "async_fd_watcher.h"
+#include "btsnoop_ring.h"
 #include "h4_protocol.h"
 
 namespace android {
@@ -30,6 +33,8 @@ namespace V1_0 {
 namespace hikey {
 
 using ::android::hardware::Return;
+using ::android::hardware::hidl_handle;
+using ::android::hardware::hidl_string;
 using ::android::hardware::hidl_vec;
 
 struct BluetoothDeathRecipient : hidl_death_recipient {
@@ -53,6 +58,11 @@ class BluetoothHci : public IBluetoothHci {
   Return<void> sendScoData(const hidl_vec<uint8_t>& packet) override;
   Return<void> close() override;
 
+  // lshal debug: capture status, or with the "snoop" option the captured
+  // packets as a btsnoop file.
+  Return<void> debug(const hidl_handle& handle,
+                     const hidl_vec<hidl_string>& options) override;
+
   static void OnPacketReady();
 
  private:
@@ -63,6 +73,9 @@ class BluetoothHci : public IBluetoothHci {
 
   hci::H4Protocol* hci_;
 
+  // Kept across close() so a capture can be dumped after a failure.
+  std::unique_ptr<hci::BtsnoopRing> snoop_;
+
   ::android::sp<BluetoothDeathRecipient> deathRecipient;
 };
 
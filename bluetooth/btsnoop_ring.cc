@@ -0,0 +1,141 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "btsnoop_ring.h"
+
+#define LOG_TAG "android.hardware.bluetooth-hci-btsnoop"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utils/Log.h>
+
+#include <algorithm>
+
+namespace {
+
+// btsnoop file format, as written by the Bluetooth stack.
+const char kBtsnoopMagic[] = "btsnoop";
+const uint32_t kBtsnoopVersion = 1;
+const uint32_t kBtsnoopDatalinkH4 = 1002;
+const uint32_t kBtsnoopFlagReceived = 1 << 0;
+const uint32_t kBtsnoopFlagCommandOrEvent = 1 << 1;
+// Microseconds from 0 AD to the Unix epoch.
+const uint64_t kBtsnoopEpochDelta = 0x00dcddb30f2f8000ULL;
+const size_t kBtsnoopRecordHeaderSize = 24;
+
+int64_t ClockNs(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+uint8_t* PutBe32(uint8_t* p, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) *p++ = value >> shift;
+  return p;
+}
+
+uint8_t* PutBe64(uint8_t* p, uint64_t value) {
+  p = PutBe32(p, value >> 32);
+  return PutBe32(p, value);
+}
+
+bool WriteAll(int fd, const uint8_t* data, size_t length) {
+  while (length > 0) {
+    ssize_t ret = TEMP_FAILURE_RETRY(write(fd, data, length));
+    if (ret <= 0) return false;
+    data += ret;
+    length -= ret;
+  }
+  return true;
+}
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// Passed by reference to std::min, so it needs storage.
+const size_t BtsnoopRing::kSnapLength;
+
+BtsnoopRing::BtsnoopRing(size_t record_count)
+    : record_count_(record_count), records_(new Record[record_count]) {
+  for (size_t i = 0; i < record_count_; i++) records_[i].sequence = 0;
+}
+
+void BtsnoopRing::Capture(bool received, uint8_t type, const uint8_t* data,
+                          size_t length) {
+  uint64_t index = next_.fetch_add(1);
+  Record& record = records_[index % record_count_];
+
+  record.sequence.store(0);
+  record.timestamp_ns = ClockNs(CLOCK_MONOTONIC);
+  record.original_length = 1 + length;
+  record.included_length = std::min(1 + length, kSnapLength);
+  record.received = received;
+  record.data[0] = type;
+  memcpy(record.data + 1, data, record.included_length - 1);
+  record.sequence.store(index + 1);
+}
+
+void BtsnoopRing::Dump(int fd) {
+  // Timestamps are monotonic, btsnoop wants wall clock time.
+  int64_t realtime_offset_ns =
+      ClockNs(CLOCK_REALTIME) - ClockNs(CLOCK_MONOTONIC);
+
+  uint8_t header[16];
+  memcpy(header, kBtsnoopMagic, sizeof(kBtsnoopMagic));
+  PutBe32(PutBe32(header + 8, kBtsnoopVersion), kBtsnoopDatalinkH4);
+  if (!WriteAll(fd, header, sizeof(header))) return;
+
+  uint64_t end = next_.load();
+  uint64_t begin = end > record_count_ ? end - record_count_ : 0;
+  size_t dumped = 0;
+  uint8_t buffer[kBtsnoopRecordHeaderSize + kSnapLength];
+  for (uint64_t index = begin; index < end; index++) {
+    Record& record = records_[index % record_count_];
+    if (record.sequence.load() != index + 1) continue;
+
+    uint32_t flags = record.received ? kBtsnoopFlagReceived : 0;
+    if (record.data[0] == HCI_PACKET_TYPE_COMMAND ||
+        record.data[0] == HCI_PACKET_TYPE_EVENT)
+      flags |= kBtsnoopFlagCommandOrEvent;
+    uint64_t timestamp_us =
+        (record.timestamp_ns + realtime_offset_ns) / 1000 + kBtsnoopEpochDelta;
+    size_t included_length = record.included_length;
+
+    uint8_t* p = PutBe32(buffer, record.original_length);
+    p = PutBe32(p, included_length);
+    p = PutBe32(p, flags);
+    p = PutBe32(p, 0);  // cumulative drops
+    p = PutBe64(p, timestamp_us);
+    memcpy(p, record.data, included_length);
+
+    // Skip the record if a capture overwrote it while it was copied.
+    if (record.sequence.load() != index + 1) continue;
+    if (!WriteAll(fd, buffer, kBtsnoopRecordHeaderSize + included_length))
+      break;
+    dumped++;
+  }
+  ALOGI("%s: %zu of %llu packets dumped", __func__, dumped,
+        static_cast<unsigned long long>(end));
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,73 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// Flight recorder of HCI traffic in btsnoop format. Records have a fixed size
+// and are claimed with one atomic increment, so capturing is lock-free and
+// never allocates; the oldest records are overwritten. Packets longer than
+// kSnapLength are truncated, which keeps whole events and SCO packets and the
+// headers of ACL packets.
+class BtsnoopRing {
+ public:
+  static const size_t kSnapLength = 1 + HCI_SCO_PREAMBLE_SIZE + 0xFF;
+  static const size_t kDefaultRecordCount = 1024;
+
+  explicit BtsnoopRing(size_t record_count = kDefaultRecordCount);
+
+  // Safe to call concurrently from the reader and the sending threads.
+  void Capture(bool received, uint8_t type, const uint8_t* data,
+               size_t length);
+
+  // Writes the records still in the ring, oldest first, as a btsnoop file.
+  void Dump(int fd);
+
+  size_t Captured() const { return next_.load(); }
+  size_t RecordCount() const { return record_count_; }
+
+ private:
+  BtsnoopRing(const BtsnoopRing&) = delete;
+  BtsnoopRing& operator=(const BtsnoopRing&) = delete;
+
+  struct Record {
+    // Index + 1 of the packet held once it is complete, 0 while written.
+    std::atomic<uint64_t> sequence;
+    int64_t timestamp_ns;  // CLOCK_MONOTONIC
+    uint32_t original_length;
+    uint32_t included_length;
+    bool received;
+    uint8_t data[kSnapLength];  // H4 type byte followed by the packet
+  };
+
+  const size_t record_count_;
+  std::unique_ptr<Record[]> records_;
+  std::atomic<uint64_t> next_{0};
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
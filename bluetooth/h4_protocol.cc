@@ -20,6 +20,62 @@
 #include <android-base/logging.h>
 #include <assert.h>
 #include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <utils/Log.h>
+
+#include <algorithm>
+
+namespace {
+
+// Connection handles go up to 0x0EFF (Volume 2, Part E, 5.4.2)
+const uint16_t kMaxConnectionHandle = 0x0EFF;
+
+bool IsReceivedPacketType(uint8_t type) {
+  return type >= HCI_PACKET_TYPE_ACL_DATA && type <= HCI_PACKET_TYPE_EVENT;
+}
+
+// Rejects preambles no controller sends: reserved event code 0, handles out
+// of range, the reserved ACL broadcast flag and reserved SCO flag bits.
+bool IsPlausiblePreamble(HciPacketType type, const uint8_t* preamble) {
+  uint16_t handle_field = preamble[0] | (preamble[1] << 8);
+  switch (type) {
+    case HCI_PACKET_TYPE_EVENT:
+      return preamble[0] != 0;
+    case HCI_PACKET_TYPE_ACL_DATA:
+      return (handle_field & 0x0FFF) <= kMaxConnectionHandle &&
+             (handle_field >> 14) != 0x3;
+    case HCI_PACKET_TYPE_SCO_DATA:
+      return (handle_field & 0x0FFF) <= kMaxConnectionHandle &&
+             (handle_field >> 14) == 0;
+    default:
+      return false;
+  }
+}
+
+// Parameter lengths the specification allows for common events, the others
+// are not checked (Volume 2, Part E, 7.7).
+bool IsPlausibleEventLength(uint8_t code, size_t length) {
+  switch (code) {
+    case 0x03:  // Connection Complete
+      return length == 11;
+    case 0x05:  // Disconnection Complete
+      return length == 4;
+    case 0x0E:  // Command Complete
+      return length >= 3;
+    case 0x0F:  // Command Status
+      return length == 4;
+    case 0x10:  // Hardware Error
+      return length == 1;
+    case 0x13:  // Number Of Completed Packets
+      return length % 4 == 1;
+    default:
+      return true;
+  }
+}
+
+}  // namespace
 
 namespace android {
 namespace hardware {
@@ -27,41 +83,165 @@ namespace bluetooth {
 namespace hci {
 
 size_t H4Protocol::Send(uint8_t type, const uint8_t* data, size_t length) {
-  int rv = WriteSafely(uart_fd_, &type, sizeof(type));
-  if (rv == sizeof(type)) {
-    rv = WriteSafely(uart_fd_, data, length);
-  }
-  return rv;
+  if (snoop_ != nullptr) snoop_->Capture(false, type, data, length);
+
+  if (type == HCI_PACKET_TYPE_ACL_DATA) return acl_flow_.Send(data, length);
+  if (type == HCI_PACKET_TYPE_COMMAND) acl_flow_.OnCommand(data, length);
+  return tx_queue_.Send(type, data, length);
+}
+
+void H4Protocol::OnPacketReady(HciPacket* packet) {
+  packet->timestamp_ns = rx_timestamp_ns_;
+  if (snoop_ != nullptr)
+    snoop_->Capture(true, packet->type, packet->data.data(),
+                    packet->data.size());
+  if (packet->type == HCI_PACKET_TYPE_EVENT)
+    acl_flow_.OnEvent(packet->data.data(), packet->data.size());
+  if (packet->type == HCI_PACKET_TYPE_SCO_DATA)
+    sco_lane_.Post(packet);
+  else
+    dispatcher_.Post(packet);
 }
 
-void H4Protocol::OnPacketReady() {
-  switch (hci_packet_type_) {
+void H4Protocol::DeliverPacket(HciPacket* packet) {
+  switch (packet->type) {
     case HCI_PACKET_TYPE_EVENT:
-      event_cb_(hci_packetizer_.GetPacket());
+      event_cb_(packet->data);
+      break;
+    case HCI_PACKET_TYPE_ACL_DATA:
+      acl_cb_(packet->data);
       break;
+    case HCI_PACKET_TYPE_SCO_DATA:
+      sco_cb_(packet->data);
+      break;
+    default:
+      // Only valid packet types get past OnBytesReceived.
+      ALOGE("%s: unexpected packet type %d", __func__, packet->type);
+      break;
+  }
+  // The binder call has completed, so the buffer is free again.
+  packet_pool_.Release(packet);
+}
+
+H4Protocol::~H4Protocol() {
+  ALOGI("%s: received %zu packets in %zu reads, %zu packet buffers used",
+        __func__, rx_packets_, rx_reads_, packet_pool_.MaxInUse());
+  if (rx_resyncs_ > 0)
+    ALOGW("%s: lost sync %zu times, %zu bytes discarded", __func__,
+          rx_resyncs_, rx_discarded_);
+}
+
+size_t H4Protocol::FrameSize(const uint8_t* data, size_t length) const {
+  if (!IsReceivedPacketType(data[0])) return kBadFrame;
+  HciPacketType type = static_cast<HciPacketType>(data[0]);
+  size_t preamble_size = HciGetPreambleSizeForType(type);
+  if (length < 1 + preamble_size) return 0;
+  if (!IsPlausiblePreamble(type, data + 1)) return kBadFrame;
+
+  // While looking for a boundary, a data packet can't be larger than the
+  // buffers the controller reported. In sync, any length on the wire is
+  // taken as it is.
+  size_t payload_length = HciGetPacketLengthForType(type, data + 1);
+  switch (type) {
     case HCI_PACKET_TYPE_ACL_DATA:
-      acl_cb_(hci_packetizer_.GetPacket());
+      if (resyncing_ && payload_length > acl_flow_.MaxAclDataLength())
+        return kBadFrame;
       break;
     case HCI_PACKET_TYPE_SCO_DATA:
-      sco_cb_(hci_packetizer_.GetPacket());
+      if (resyncing_ && payload_length > acl_flow_.MaxScoDataLength())
+        return kBadFrame;
       break;
-    default: {
-      bool bad_packet_type = true;
-      CHECK(!bad_packet_type);
+    default:
+      if (!IsPlausibleEventLength(data[1], payload_length)) return kBadFrame;
+      break;
+  }
+
+  size_t frame_size = 1 + preamble_size + payload_length;
+  // While looking for a boundary, a candidate also has to be followed by
+  // another packet type, when the next byte is there already.
+  if (resyncing_ && length > frame_size &&
+      !IsReceivedPacketType(data[frame_size]))
+    return kBadFrame;
+  return length < frame_size ? 0 : frame_size;
+}
+
+void H4Protocol::OnBytesReceived() {
+  const uint8_t* data = rx_buffer_.data();
+  size_t offset = 0;
+
+  // Deliver every complete frame in the buffer. Bytes that can't start a
+  // frame are dropped one at a time until a plausible frame boundary is
+  // found again.
+  while (offset < rx_length_) {
+    size_t frame_size = FrameSize(data + offset, rx_length_ - offset);
+    if (frame_size == kBadFrame) {
+      if (!resyncing_) {
+        ALOGW("%s: lost sync on byte 0x%02x", __func__, data[offset]);
+        resyncing_ = true;
+        rx_resyncs_++;
+        resync_discarded_ = 0;
+      }
+      offset++;
+      rx_discarded_++;
+      resync_discarded_++;
+      continue;
+    }
+    if (frame_size == 0) break;
+
+    HciPacketType packet_type = static_cast<HciPacketType>(data[offset]);
+    size_t packet_size = hci_packetizer_.OnDataReady(
+        data + offset + 1, frame_size - 1, packet_type);
+    if (packet_size == 0) break;
+    if (resyncing_) {
+      ALOGW("%s: back in sync after discarding %zu bytes", __func__,
+            resync_discarded_);
+      resyncing_ = false;
     }
+    offset += frame_size;
+    rx_packets_++;
   }
-  // Get ready for the next type byte.
-  hci_packet_type_ = HCI_PACKET_TYPE_UNKNOWN;
+  // Carry the partial tail over to the next read.
+  rx_length_ -= offset;
+  if (rx_length_ > 0 && offset > 0)
+    memmove(rx_buffer_.data(), data + offset, rx_length_);
 }
 
+// The UART is watched edge-triggered, so everything queued in the driver is
+// read before returning. The TI hci_tty driver reports only the packet at the
+// head of its queue in FIONREAD and returns one packet per read, so FIONREAD
+// is asked again after every read until nothing is left.
 void H4Protocol::OnDataReady(int fd) {
-  if (hci_packet_type_ == HCI_PACKET_TYPE_UNKNOWN) {
-    uint8_t buffer[1] = {0};
-    size_t bytes_read = TEMP_FAILURE_RETRY(read(fd, buffer, 1));
-    CHECK(bytes_read == 1);
-    hci_packet_type_ = static_cast<HciPacketType>(buffer[0]);
-  } else {
-    hci_packetizer_.OnDataReady(fd, hci_packet_type_);
+  for (;;) {
+    // The driver must be read for exactly the number of bytes it reports.
+    int tty_bytes = 0;
+    if (TEMP_FAILURE_RETRY(ioctl(fd, FIONREAD, &tty_bytes))) {
+      ALOGE("%s:FIONREAD %s", __func__, strerror(errno));
+      return;
+    }
+    ALOGV("%s:tty_bytes = %d", __func__, tty_bytes);
+    if (tty_bytes <= 0) return;
+
+    size_t to_read = std::min(static_cast<size_t>(tty_bytes),
+                              rx_buffer_.size() - rx_length_);
+    if (to_read == 0) {
+      ALOGE("%s: receive buffer full, %d bytes left in the driver", __func__,
+            tty_bytes);
+      return;
+    }
+    ssize_t bytes_read = TEMP_FAILURE_RETRY(
+        read(fd, rx_buffer_.data() + rx_length_, to_read));
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    if (bytes_read <= 0) {
+      ALOGE("%s: read %zu bytes failed (%s)", __func__, to_read,
+            bytes_read < 0 ? strerror(errno) : "end of file");
+      return;
+    }
+    rx_reads_++;
+    rx_length_ += bytes_read;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rx_timestamp_ns_ = now.tv_sec * 1000000000LL + now.tv_nsec;
+    OnBytesReceived();
   }
 }
 
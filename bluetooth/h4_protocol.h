@@ -16,11 +16,18 @@
 
 #pragma once
 
+#include <vector>
+
 #include <hidl/HidlSupport.h>
 
 #include "async_fd_watcher.h"
+#include "btsnoop_ring.h"
+#include "hci_acl_flow.h"
+#include "hci_dispatcher.h"
 #include "hci_internals.h"
 #include "hci_protocol.h"
+#include "hci_sco_lane.h"
+#include "hci_tx_queue.h"
 
 namespace android {
 namespace hardware {
@@ -29,29 +36,96 @@ namespace hci {
 
 class H4Protocol : public HciProtocol {
  public:
+  // The fd is switched to non-blocking mode: frames that the UART does not
+  // take right away are written from OnWriteReady, which has to be called
+  // when the fd becomes writable while the watch set with SetWriteWatch is
+  // enabled. ACL data is held back until the
+  // controller has buffers for it. sco_jitter_depth is the number of
+  // received SCO packets buffered before delivery, 0 for none.
   H4Protocol(int fd, PacketReadCallback event_cb, PacketReadCallback acl_cb,
-             PacketReadCallback sco_cb)
+             PacketReadCallback sco_cb, size_t sco_jitter_depth = 0)
       : uart_fd_(fd),
         event_cb_(event_cb),
         acl_cb_(acl_cb),
         sco_cb_(sco_cb),
-        hci_packetizer_([this]() { OnPacketReady(); }) {}
+        rx_buffer_(kRxBufferSize),
+        packet_pool_(kPacketPoolSize),
+        hci_packetizer_(packet_pool_,
+                        [this](HciPacket* packet) { OnPacketReady(packet); }),
+        dispatcher_(packet_pool_,
+                    [this](HciPacket* packet) { DeliverPacket(packet); }),
+        sco_lane_(packet_pool_,
+                  [this](HciPacket* packet) { DeliverPacket(packet); },
+                  sco_jitter_depth),
+        tx_queue_(fd),
+        acl_flow_([this](const uint8_t* data, size_t length) {
+          tx_queue_.Send(HCI_PACKET_TYPE_ACL_DATA, data, length);
+        }) {}
+  ~H4Protocol();
 
   size_t Send(uint8_t type, const uint8_t* data, size_t length);
 
-  void OnPacketReady();
+  // See HciTxQueue::SetWriteWatch.
+  void SetWriteWatch(HciWriteWatchCallback watch_cb) {
+    tx_queue_.SetWriteWatch(watch_cb);
+  }
+
+  // Records every packet sent and received into snoop, nullptr to stop.
+  void SetSnoop(BtsnoopRing* snoop) { snoop_ = snoop; }
+
+  void OnPacketReady(HciPacket* packet);
 
   void OnDataReady(int fd);
 
+  void OnWriteReady(int fd) { tx_queue_.OnWriteReady(); }
+
  private:
-  int uart_fd_;
+  // The largest H4 frame is an ACL packet with a 16-bit length.
+  static const size_t kMaxFrameSize = 1 + HCI_ACL_PREAMBLE_SIZE + 0xFFFF;
+  // Room for one partial frame carried over plus a full read behind it.
+  static const size_t kRxBufferSize = 2 * kMaxFrameSize;
+  // Enough packets for both queues to be full, with one packet being parsed
+  // and one being delivered by each of the two delivery threads.
+  static const size_t kPacketPoolSize =
+      HciDispatcher::kQueueSize + HciScoLane::kQueueSize + 3;
+
+  // FrameSize result for bytes that can't be the start of a frame.
+  static const size_t kBadFrame = static_cast<size_t>(-1);
 
+  // Size of the H4 frame starting at data, or 0 while it is incomplete.
+  size_t FrameSize(const uint8_t* data, size_t length) const;
+  void OnBytesReceived();
+  // Runs on the dispatcher and SCO lane threads.
+  void DeliverPacket(HciPacket* packet);
+
+  int uart_fd_;
   PacketReadCallback event_cb_;
   PacketReadCallback acl_cb_;
   PacketReadCallback sco_cb_;
 
-  HciPacketType hci_packet_type_{HCI_PACKET_TYPE_UNKNOWN};
+  // Bytes are read from the UART into this buffer and parsed in place. An
+  // incomplete frame at the end is moved to the front for the next read.
+  std::vector<uint8_t> rx_buffer_;
+  size_t rx_length_{0};
+  size_t rx_reads_{0};
+  size_t rx_packets_{0};
+  int64_t rx_timestamp_ns_{0};
+  // Set from a bad byte until the next valid frame.
+  bool resyncing_{false};
+  size_t resync_discarded_{0};
+  size_t rx_resyncs_{0};
+  size_t rx_discarded_{0};
+
+  HciPacketPool packet_pool_;
   hci::HciPacketizer hci_packetizer_;
+  HciDispatcher dispatcher_;
+  HciScoLane sco_lane_;
+
+  HciTxQueue tx_queue_;
+  // Declared last so its thread stops before the transmit path goes away.
+  HciAclFlowControl acl_flow_;
+
+  BtsnoopRing* snoop_{nullptr};
 };
 
 }  // namespace hci
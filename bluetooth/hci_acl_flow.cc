@@ -0,0 +1,330 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_acl_flow.h"
+
+#define LOG_TAG "android.hardware.bluetooth-hci-acl_flow"
+#include <utils/Log.h>
+
+#include <algorithm>
+
+namespace {
+
+// Events (Volume 2, Part E, 7.7)
+const uint8_t kConnectionCompleteEvent = 0x03;
+const uint8_t kDisconnectionCompleteEvent = 0x05;
+const uint8_t kNumberOfCompletedPacketsEvent = 0x13;
+const uint8_t kLeMetaEvent = 0x3E;
+const uint8_t kLeConnectionCompleteSubevent = 0x01;
+const uint8_t kLeEnhancedConnectionCompleteSubevent = 0x0A;
+
+// Commands that are tracked (Volume 2, Part E, 7.1 - 7.8)
+const uint16_t kDisconnectOpcode = 0x0406;
+const uint16_t kResetOpcode = 0x0C03;
+const uint16_t kHostBufferSizeOpcode = 0x0C33;
+const uint16_t kReadBufferSizeOpcode = 0x1005;
+const uint16_t kLeReadBufferSizeOpcode = 0x2002;
+const uint16_t kLeReadBufferSizeV2Opcode = 0x2060;
+
+uint16_t Read16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+
+uint16_t HandleOf(const uint8_t* p) { return Read16(p) & 0x0FFF; }
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+void HciAclFlowControl::BufferPool::SetTotal(size_t count) {
+  // Packets already in flight keep holding their buffers.
+  size_t in_flight = total > free ? total - free : 0;
+  total = count;
+  free = count > in_flight ? count - in_flight : 0;
+}
+
+void HciAclFlowControl::BufferPool::Return(size_t count) {
+  free = std::min(total, free + count);
+}
+
+HciAclFlowControl::HciAclFlowControl(HciAclWriteCallback write_cb)
+    : write_cb_(write_cb) {
+  thread_ = std::thread([this]() { ThreadRoutine(); });
+}
+
+HciAclFlowControl::~HciAclFlowControl() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    exit_ = true;
+  }
+  can_send_.notify_one();
+  not_full_.notify_all();
+  written_.notify_all();
+  if (thread_.joinable()) thread_.join();
+
+  ALOGI("%s: ACL %zu buffers, max %zu queued, %zu credit waits", __func__,
+        acl_.total, acl_.max_queued, acl_.credit_waits);
+  ALOGI("%s: LE %zu buffers, max %zu queued, %zu credit waits", __func__,
+        le_.total, le_.max_queued, le_.credit_waits);
+  ALOGI("%s: %zu full queue waits, %zu packets flushed, %zu dropped", __func__,
+        full_waits_, flushed_, queued_);
+}
+
+// Called with mutex_ held.
+HciAclFlowControl::BufferPool& HciAclFlowControl::PoolFor(uint16_t handle) {
+  auto connection = connections_.find(handle);
+  // LE links share the ACL buffers when the controller has no LE buffers.
+  if (connection != connections_.end() && connection->second.le &&
+      le_.total > 0)
+    return le_;
+  return acl_;
+}
+
+// Called with mutex_ held.
+void HciAclFlowControl::Flush(BufferPool& pool, bool all, uint16_t handle) {
+  auto keep = pool.queue.begin();
+  for (auto packet = pool.queue.begin(); packet != pool.queue.end(); ++packet) {
+    if (!all && HandleOf(packet->data()) != handle) {
+      if (keep != packet) *keep = std::move(*packet);
+      ++keep;
+      continue;
+    }
+    spare_.push_back(std::move(*packet));
+    queued_--;
+    flushed_++;
+  }
+  pool.queue.erase(keep, pool.queue.end());
+  not_full_.notify_all();
+}
+
+// Called with mutex_ held. Returns once the packet the thread took off a
+// queue, if any, is on its way to the controller.
+void HciAclFlowControl::WaitForWrite(std::unique_lock<std::mutex>& guard) {
+  written_.wait(guard, [this] { return exit_ || !writing_; });
+}
+
+size_t HciAclFlowControl::Send(const uint8_t* data, size_t length) {
+  if (length < HCI_ACL_PREAMBLE_SIZE) {
+    ALOGE("%s: %zu byte ACL packet is too short", __func__, length);
+    return 0;
+  }
+
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (queued_ >= kMaxQueuedPackets) {
+      full_waits_++;
+      not_full_.wait(guard,
+                     [this] { return exit_ || queued_ < kMaxQueuedPackets; });
+      if (exit_) return 0;
+    }
+
+    std::vector<uint8_t> packet;
+    if (!spare_.empty()) {
+      packet = std::move(spare_.back());
+      spare_.pop_back();
+    }
+    packet.assign(data, data + length);
+
+    BufferPool& pool = PoolFor(HandleOf(data));
+    if (pool.total > 0 && pool.free == 0) pool.credit_waits++;
+    pool.queue.push_back(std::move(packet));
+    pool.max_queued = std::max(pool.max_queued, pool.queue.size());
+    queued_++;
+  }
+  can_send_.notify_one();
+  return length;
+}
+
+void HciAclFlowControl::OnCommand(const uint8_t* data, size_t length) {
+  if (length < HCI_COMMAND_PREAMBLE_SIZE) return;
+  uint16_t opcode = Read16(data);
+
+  std::unique_lock<std::mutex> guard(mutex_);
+  if (opcode == kResetOpcode) {
+    Flush(acl_, true, 0);
+    Flush(le_, true, 0);
+  } else if (opcode == kDisconnectOpcode &&
+             length >= HCI_COMMAND_PREAMBLE_SIZE + 2) {
+    uint16_t handle = HandleOf(data + HCI_COMMAND_PREAMBLE_SIZE);
+    Flush(PoolFor(handle), false, handle);
+  } else if (opcode == kHostBufferSizeOpcode &&
+             length >= HCI_COMMAND_PREAMBLE_SIZE + 3) {
+    const uint8_t* params = data + HCI_COMMAND_PREAMBLE_SIZE;
+    host_acl_length_ = Read16(params);
+    host_sco_length_ = params[2];
+    UpdateMaxLengths();
+    return;
+  } else {
+    return;
+  }
+  WaitForWrite(guard);
+}
+
+void HciAclFlowControl::OnEvent(const uint8_t* data, size_t length) {
+  if (length < HCI_EVENT_PREAMBLE_SIZE) return;
+  const uint8_t* params = data + HCI_EVENT_PREAMBLE_SIZE;
+  size_t params_length = std::min(static_cast<size_t>(data[1]),
+                                  length - HCI_EVENT_PREAMBLE_SIZE);
+
+  switch (data[0]) {
+    case HCI_COMMAND_COMPLETE_EVENT:
+      OnCommandComplete(params, params_length);
+      break;
+    case kNumberOfCompletedPacketsEvent:
+      OnCompletedPackets(params, params_length);
+      break;
+    case kConnectionCompleteEvent:
+      if (params_length >= 3 && params[0] == 0)
+        OnConnected(HandleOf(params + 1), false);
+      break;
+    case kLeMetaEvent:
+      if (params_length >= 4 &&
+          (params[0] == kLeConnectionCompleteSubevent ||
+           params[0] == kLeEnhancedConnectionCompleteSubevent) &&
+          params[1] == 0)
+        OnConnected(HandleOf(params + 2), true);
+      break;
+    case kDisconnectionCompleteEvent:
+      if (params_length >= 3 && params[0] == 0)
+        OnDisconnected(HandleOf(params + 1));
+      break;
+    default:
+      return;
+  }
+}
+
+void HciAclFlowControl::OnCommandComplete(const uint8_t* params,
+                                          size_t length) {
+  // Num_HCI_Command_Packets, Command_Opcode, then the return parameters
+  // starting with a status.
+  if (length < 4 || params[3] != 0) return;
+  uint16_t opcode = Read16(params + 1);
+  const uint8_t* ret = params + 3;
+  size_t ret_length = length - 3;
+
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (opcode == kResetOpcode) {
+      // The controller forgets its connections and frees its buffers.
+      connections_.clear();
+      acl_.SetTotal(0);
+      le_.SetTotal(0);
+    } else if (opcode == kReadBufferSizeOpcode && ret_length >= 6) {
+      acl_.SetTotal(Read16(ret + 4));
+      acl_length_ = Read16(ret + 1);
+      sco_length_ = ret[3];
+      UpdateMaxLengths();
+      ALOGI("%s: %zu ACL buffers of %zu bytes", __func__, acl_.total,
+            acl_length_);
+    } else if ((opcode == kLeReadBufferSizeOpcode ||
+                opcode == kLeReadBufferSizeV2Opcode) &&
+               ret_length >= 4) {
+      le_.SetTotal(ret[3]);
+      le_length_ = Read16(ret + 1);
+      UpdateMaxLengths();
+      ALOGI("%s: %zu LE buffers of %zu bytes", __func__, le_.total,
+            le_length_);
+    } else {
+      return;
+    }
+  }
+  can_send_.notify_one();
+}
+
+void HciAclFlowControl::OnCompletedPackets(const uint8_t* params,
+                                           size_t length) {
+  if (length < 1) return;
+  size_t count = std::min(static_cast<size_t>(params[0]), (length - 1) / 4);
+
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    for (size_t i = 0; i < count; i++) {
+      const uint8_t* entry = params + 1 + 4 * i;
+      uint16_t handle = HandleOf(entry);
+      size_t completed = Read16(entry + 2);
+      auto connection = connections_.find(handle);
+      if (connection != connections_.end())
+        connection->second.in_flight -=
+            std::min(completed, connection->second.in_flight);
+      PoolFor(handle).Return(completed);
+    }
+  }
+  can_send_.notify_one();
+}
+
+void HciAclFlowControl::OnConnected(uint16_t handle, bool le) {
+  std::unique_lock<std::mutex> guard(mutex_);
+  connections_[handle] = Connection{le, 0};
+}
+
+void HciAclFlowControl::OnDisconnected(uint16_t handle) {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    auto connection = connections_.find(handle);
+    if (connection == connections_.end()) return;
+    // The controller flushes what it still holds for the link, and the
+    // handle may be given to the next connection.
+    BufferPool& pool = PoolFor(handle);
+    pool.Return(connection->second.in_flight);
+    Flush(pool, false, handle);
+    connections_.erase(connection);
+  }
+  can_send_.notify_one();
+}
+
+// Called with mutex_ held.
+void HciAclFlowControl::UpdateMaxLengths() {
+  size_t acl = std::max({acl_length_, le_length_, host_acl_length_});
+  size_t sco = std::max(sco_length_, host_sco_length_);
+  max_acl_length_ = acl > 0 ? acl : kDefaultMaxAclDataLength;
+  max_sco_length_ = sco > 0 ? sco : 0xFF;
+}
+
+void HciAclFlowControl::ThreadRoutine() {
+  std::unique_lock<std::mutex> guard(mutex_);
+  while (true) {
+    can_send_.wait(guard,
+                   [this] { return exit_ || acl_.CanSend() || le_.CanSend(); });
+    if (exit_) break;
+
+    bool le = le_.CanSend() && (!acl_.CanSend() || le_turn_);
+    BufferPool& pool = le ? le_ : acl_;
+    le_turn_ = !le;
+    std::vector<uint8_t> packet = std::move(pool.queue.front());
+    pool.queue.pop_front();
+    queued_--;
+    if (pool.total > 0) pool.free--;
+    uint16_t handle = HandleOf(packet.data());
+    auto connection = connections_.find(handle);
+    if (connection != connections_.end()) connection->second.in_flight++;
+    writing_ = true;
+    not_full_.notify_one();
+    guard.unlock();
+
+    write_cb_(packet.data(), packet.size());
+
+    guard.lock();
+    writing_ = false;
+    written_.notify_all();
+    spare_.push_back(std::move(packet));
+  }
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
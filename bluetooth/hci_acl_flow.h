@@ -0,0 +1,148 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+using HciAclWriteCallback =
+    std::function<void(const uint8_t* data, size_t length)>;
+
+// Host side ACL flow control. The controller buffer counts are learned from
+// the Read Buffer Size and LE Read Buffer Size completions the stack asks
+// for, and credits come back with Number Of Completed Packets events or when
+// a connection goes down. ACL packets are queued and written from a separate
+// thread only when the controller has room for them, so the binder thread
+// sending them never waits on the UART. Until the buffer counts are known,
+// packets are written as soon as they are queued.
+//
+// Commands bypass the queues, so data queued for a link is dropped when the
+// stack resets the controller or disconnects the link rather than sent after
+// the command. When both transports have credits they take turns, one packet
+// each, so a busy LE link can't starve BR/EDR data or the other way round.
+class HciAclFlowControl {
+ public:
+  // Sending only blocks when the stack has this many packets waiting for
+  // credits, i.e. when it ignores the controller buffer counts itself.
+  static const size_t kMaxQueuedPackets = 64;
+  // Largest ACL payload expected before any buffer size is known, the usual
+  // size of a 3-DH5 packet.
+  static const size_t kDefaultMaxAclDataLength = 1021;
+
+  explicit HciAclFlowControl(HciAclWriteCallback write_cb);
+  ~HciAclFlowControl();
+
+  // Queues an ACL packet, without its H4 packet type.
+  size_t Send(const uint8_t* data, size_t length);
+
+  // Called with every command, without its H4 packet type, before it is
+  // written.
+  void OnCommand(const uint8_t* data, size_t length);
+
+  // Called from the reader thread with every event from the controller.
+  void OnEvent(const uint8_t* data, size_t length);
+
+  // Largest ACL and SCO payloads the controller may send: the larger of the
+  // buffer sizes it reported and the host buffer sizes the stack set. Can be
+  // called from any thread.
+  size_t MaxAclDataLength() const { return max_acl_length_; }
+  size_t MaxScoDataLength() const { return max_sco_length_; }
+
+ private:
+  HciAclFlowControl(const HciAclFlowControl&) = delete;
+  HciAclFlowControl& operator=(const HciAclFlowControl&) = delete;
+
+  // Controller buffers shared by the connections of one transport.
+  struct BufferPool {
+    size_t total{0};  // 0 while unknown: no limit
+    size_t free{0};
+    std::deque<std::vector<uint8_t>> queue;
+    // Statistics, logged when flow control is destroyed.
+    size_t max_queued{0};
+    size_t credit_waits{0};
+
+    bool CanSend() const { return !queue.empty() && (total == 0 || free > 0); }
+    void SetTotal(size_t count);
+    void Return(size_t count);
+  };
+
+  struct Connection {
+    bool le;
+    size_t in_flight;
+  };
+
+  BufferPool& PoolFor(uint16_t handle);
+  // Drops the queued packets of handle, or of every handle when all is set.
+  void Flush(BufferPool& pool, bool all, uint16_t handle);
+  void WaitForWrite(std::unique_lock<std::mutex>& guard);
+  void OnCommandComplete(const uint8_t* params, size_t length);
+  void OnCompletedPackets(const uint8_t* params, size_t length);
+  void OnConnected(uint16_t handle, bool le);
+  void OnDisconnected(uint16_t handle);
+  void UpdateMaxLengths();
+  void ThreadRoutine();
+
+  HciAclWriteCallback write_cb_;
+
+  BufferPool acl_;
+  BufferPool le_;
+  std::unordered_map<uint16_t, Connection> connections_;
+  // Packet lengths from Read Buffer Size, LE Read Buffer Size and Host
+  // Buffer Size, 0 until known.
+  size_t acl_length_{0};
+  size_t le_length_{0};
+  size_t host_acl_length_{0};
+  size_t sco_length_{0};
+  size_t host_sco_length_{0};
+  std::atomic<size_t> max_acl_length_{kDefaultMaxAclDataLength};
+  std::atomic<size_t> max_sco_length_{0xFF};
+  size_t queued_{0};
+  // Whether LE goes next when both transports have credits.
+  bool le_turn_{false};
+  // A packet taken off a queue is being written.
+  bool writing_{false};
+  // Buffers of written packets, reused for the next ones.
+  std::vector<std::vector<uint8_t>> spare_;
+  bool exit_{false};
+
+  std::mutex mutex_;
+  std::condition_variable can_send_;
+  std::condition_variable not_full_;
+  std::condition_variable written_;
+  std::thread thread_;
+
+  size_t full_waits_{0};
+  size_t flushed_{0};
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,97 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_dispatcher.h"
+
+#define LOG_TAG "android.hardware.bluetooth-hci-dispatcher"
+#include <utils/Log.h>
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciDispatcher::HciDispatcher(HciPacketPool& pool,
+                             HciPacketDeliverCallback deliver_cb)
+    : pool_(pool), deliver_cb_(deliver_cb) {
+  thread_ = std::thread([this]() { ThreadRoutine(); });
+}
+
+HciDispatcher::~HciDispatcher() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    exit_ = true;
+  }
+  not_empty_.notify_one();
+  not_full_.notify_one();
+  if (thread_.joinable()) thread_.join();
+
+  // The stack is going away, return what was not delivered.
+  HciPacket* packet;
+  while ((packet = queue_.Pop()) != nullptr) pool_.Release(packet);
+
+  ALOGI("%s: queue high water mark %zu/%zu, %zu full waits", __func__,
+        high_water_, kQueueSize, full_waits_);
+}
+
+void HciDispatcher::Post(HciPacket* packet) {
+  while (!queue_.Push(packet)) {
+    full_waits_++;
+    std::unique_lock<std::mutex> guard(mutex_);
+    producer_waiting_ = true;
+    not_full_.wait(guard, [this] { return exit_ || !queue_.Full(); });
+    producer_waiting_ = false;
+    if (exit_) {
+      pool_.Release(packet);
+      return;
+    }
+  }
+
+  high_water_ = std::max(high_water_, queue_.Size());
+
+  if (consumer_waiting_) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    not_empty_.notify_one();
+  }
+}
+
+void HciDispatcher::ThreadRoutine() {
+  while (true) {
+    HciPacket* packet = queue_.Pop();
+
+    if (packet != nullptr) {
+      deliver_cb_(packet);
+      if (producer_waiting_) {
+        std::unique_lock<std::mutex> guard(mutex_);
+        not_full_.notify_one();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> guard(mutex_);
+    consumer_waiting_ = true;
+    not_empty_.wait(guard, [this] { return exit_ || !queue_.Empty(); });
+    consumer_waiting_ = false;
+    if (exit_) break;
+  }
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
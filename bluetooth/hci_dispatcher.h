@@ -0,0 +1,112 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "hci_packet_pool.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// Lock-free ring of packets with one producer and one consumer thread.
+template <size_t N>
+class HciPacketQueue {
+  static_assert((N & (N - 1)) == 0, "queue size must be a power of two");
+
+ public:
+  // Returns false when the queue is full.
+  bool Push(HciPacket* packet) {
+    size_t tail = tail_.load();
+    if (tail - head_.load() == N) return false;
+    slots_[tail & (N - 1)] = packet;
+    tail_.store(tail + 1);
+    return true;
+  }
+
+  // Returns nullptr when the queue is empty.
+  HciPacket* Pop() {
+    size_t head = head_.load();
+    if (head == tail_.load()) return nullptr;
+    HciPacket* packet = slots_[head & (N - 1)];
+    head_.store(head + 1);
+    return packet;
+  }
+
+  size_t Size() const { return tail_.load() - head_.load(); }
+  bool Empty() const { return Size() == 0; }
+  bool Full() const { return Size() == N; }
+
+ private:
+  std::array<HciPacket*, N> slots_;
+  std::atomic<size_t> head_{0};
+  std::atomic<size_t> tail_{0};
+};
+
+using HciPacketDeliverCallback = std::function<void(HciPacket*)>;
+
+// Moves the HIDL callbacks off the UART reader thread. Events and ACL packets
+// share one bounded queue and are delivered by a dispatch thread in the order
+// they arrived, so the stack never sees a Disconnection Complete or Number of
+// Completed Packets event ahead of ACL data received before it. SCO has its
+// own lane, see HciScoLane. The deliver callback owns each packet it is given.
+class HciDispatcher {
+ public:
+  static const size_t kQueueSize = 32;
+
+  HciDispatcher(HciPacketPool& pool, HciPacketDeliverCallback deliver_cb);
+  ~HciDispatcher();
+
+  // Called from the reader thread. When the queue is full, waits for the
+  // dispatch thread to make room.
+  void Post(HciPacket* packet);
+
+ private:
+  HciDispatcher(const HciDispatcher&) = delete;
+  HciDispatcher& operator=(const HciDispatcher&) = delete;
+
+  void ThreadRoutine();
+
+  HciPacketPool& pool_;
+  HciPacketDeliverCallback deliver_cb_;
+
+  HciPacketQueue<kQueueSize> queue_;
+
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::atomic_bool consumer_waiting_{false};
+  std::atomic_bool producer_waiting_{false};
+  bool exit_{false};
+  std::thread thread_;
+
+  // Statistics, logged when the dispatcher is destroyed.
+  size_t high_water_{0};
+  size_t full_waits_{0};
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
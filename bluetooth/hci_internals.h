@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <stdlib.h>
 
 // HCI UART transport packet types (Volume 4, Part A, 2)
@@ -0,0 +1,65 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_packet_pool.h"
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciPacketPool::HciPacketPool(size_t packet_count)
+    : storage_(new uint8_t[packet_count * kBufferSize]),
+      packets_(packet_count) {
+  free_.reserve(packet_count);
+  for (size_t i = 0; i < packet_count; i++) {
+    packets_[i].buffer = storage_.get() + i * kBufferSize;
+    free_.push_back(&packets_[i]);
+  }
+}
+
+HciPacket* HciPacketPool::Acquire() {
+  std::unique_lock<std::mutex> guard(mutex_);
+  if (free_.empty()) return nullptr;
+  HciPacket* packet = free_.back();
+  free_.pop_back();
+  max_in_use_ = std::max(max_in_use_, packets_.size() - free_.size());
+  return packet;
+}
+
+void HciPacketPool::Release(HciPacket* packet) {
+  if (packet == nullptr) return;
+  packet->type = HCI_PACKET_TYPE_UNKNOWN;
+  std::unique_lock<std::mutex> guard(mutex_);
+  free_.push_back(packet);
+}
+
+size_t HciPacketPool::InUse() {
+  std::unique_lock<std::mutex> guard(mutex_);
+  return packets_.size() - free_.size();
+}
+
+size_t HciPacketPool::MaxInUse() {
+  std::unique_lock<std::mutex> guard(mutex_);
+  return max_in_use_;
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
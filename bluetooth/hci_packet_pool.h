@@ -0,0 +1,80 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <hidl/HidlSupport.h>
+
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+using ::android::hardware::hidl_vec;
+
+// A received packet. data is a non-owning view of a pool buffer, so it can be
+// passed to the HIDL callbacks without a copy.
+struct HciPacket {
+  HciPacketType type{HCI_PACKET_TYPE_UNKNOWN};
+  // CLOCK_MONOTONIC time of the read that completed the packet.
+  int64_t timestamp_ns{0};
+  hidl_vec<uint8_t> data;
+  uint8_t* buffer{nullptr};
+};
+
+// Fixed set of maximum-size receive buffers. Packets are acquired by the
+// packetizer and released by whoever delivered them, so receiving does not
+// allocate once the pool exists.
+class HciPacketPool {
+ public:
+  // An ACL packet with a 16-bit length is the largest HCI packet.
+  static const size_t kBufferSize = HCI_ACL_PREAMBLE_SIZE + 0xFFFF;
+  static const size_t kDefaultPacketCount = 16;
+
+  explicit HciPacketPool(size_t packet_count = kDefaultPacketCount);
+
+  // Returns nullptr when every packet is in use.
+  HciPacket* Acquire();
+  void Release(HciPacket* packet);
+
+  size_t InUse();
+  size_t MaxInUse();
+
+ private:
+  HciPacketPool(const HciPacketPool&) = delete;
+  HciPacketPool& operator=(const HciPacketPool&) = delete;
+
+  // One allocation for all buffers. Pages are only touched up to the largest
+  // packet actually received, which is far below kBufferSize on most
+  // controllers.
+  std::unique_ptr<uint8_t[]> storage_;
+  std::vector<HciPacket> packets_;
+
+  std::mutex mutex_;
+  std::vector<HciPacket*> free_;
+  size_t max_in_use_{0};
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -20,8 +20,7 @@
 #include <android-base/logging.h>
 #include <utils/Log.h>
 
-#include <dlfcn.h>
-#include <fcntl.h>
+#include <string.h>
 
 namespace {
 
@@ -32,12 +31,6 @@ const size_t packet_length_offset_for_type[] = {
     0, HCI_LENGTH_OFFSET_CMD, HCI_LENGTH_OFFSET_ACL, HCI_LENGTH_OFFSET_SCO,
     HCI_LENGTH_OFFSET_EVT};
 
-size_t HciGetPacketLengthForType(HciPacketType type, const uint8_t* preamble) {
-  size_t offset = packet_length_offset_for_type[type];
-  if (type != HCI_PACKET_TYPE_ACL_DATA) return preamble[offset];
-  return (((preamble[offset + 1]) << 8) | preamble[offset]);
-}
-
 }  // namespace
 
 namespace android {
@@ -45,44 +38,32 @@ namespace hardware {
 namespace bluetooth {
 namespace hci {
 
-const hidl_vec<uint8_t>& HciPacketizer::GetPacket() const { return packet_; }
+size_t HciGetPreambleSizeForType(HciPacketType type) {
+  return preamble_size_for_type[type];
+}
+
+size_t HciGetPacketLengthForType(HciPacketType type, const uint8_t* preamble) {
+  size_t offset = packet_length_offset_for_type[type];
+  if (type != HCI_PACKET_TYPE_ACL_DATA) return preamble[offset];
+  return (((preamble[offset + 1]) << 8) | preamble[offset]);
+}
+
+size_t HciPacketizer::OnDataReady(const uint8_t* data, size_t length,
+                                  HciPacketType packet_type) {
+  size_t preamble_size = HciGetPreambleSizeForType(packet_type);
+  if (length < preamble_size) return 0;
 
-void HciPacketizer::OnDataReady(int fd, HciPacketType packet_type) {
-  switch (state_) {
-    case HCI_PREAMBLE: {
-      size_t bytes_read = TEMP_FAILURE_RETRY(
-          read(fd, preamble_ + bytes_read_,
-               preamble_size_for_type[packet_type] - bytes_read_));
-      CHECK(bytes_read > 0);
-      bytes_read_ += bytes_read;
-      if (bytes_read_ == preamble_size_for_type[packet_type]) {
-        size_t packet_length =
-            HciGetPacketLengthForType(packet_type, preamble_);
-        packet_.resize(preamble_size_for_type[packet_type] + packet_length);
-        memcpy(packet_.data(), preamble_, preamble_size_for_type[packet_type]);
-        bytes_remaining_ = packet_length;
-        state_ = HCI_PAYLOAD;
-        bytes_read_ = 0;
-      }
-      break;
-    }
+  size_t packet_size =
+      preamble_size + HciGetPacketLengthForType(packet_type, data);
+  if (length < packet_size) return 0;
 
-    case HCI_PAYLOAD: {
-      size_t bytes_read = TEMP_FAILURE_RETRY(read(
-          fd,
-          packet_.data() + preamble_size_for_type[packet_type] + bytes_read_,
-          bytes_remaining_));
-      CHECK(bytes_read > 0);
-      bytes_remaining_ -= bytes_read;
-      bytes_read_ += bytes_read;
-      if (bytes_remaining_ == 0) {
-        packet_ready_cb_();
-        state_ = HCI_PREAMBLE;
-        bytes_read_ = 0;
-      }
-      break;
-    }
-  }
+  HciPacket* packet = pool_.Acquire();
+  if (packet == nullptr) return 0;
+  memcpy(packet->buffer, data, packet_size);
+  packet->type = packet_type;
+  packet->data.setToExternal(packet->buffer, packet_size);
+  packet_ready_cb_(packet);
+  return packet_size;
 }
 
 }  // namespace hci
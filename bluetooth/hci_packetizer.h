@@ -18,32 +18,36 @@
 
 #include <functional>
 
-#include <hidl/HidlSupport.h>
-
 #include "hci_internals.h"
+#include "hci_packet_pool.h"
 
 namespace android {
 namespace hardware {
 namespace bluetooth {
 namespace hci {
 
-using ::android::hardware::hidl_vec;
-using HciPacketReadyCallback = std::function<void(void)>;
+using HciPacketReadyCallback = std::function<void(HciPacket*)>;
+
+// Size of the preamble of a packet of the given type, without the H4 type.
+size_t HciGetPreambleSizeForType(HciPacketType type);
+// Payload length announced by the preamble of a packet of the given type.
+size_t HciGetPacketLengthForType(HciPacketType type, const uint8_t* preamble);
 
 class HciPacketizer {
  public:
-  HciPacketizer(HciPacketReadyCallback packet_cb)
-      : packet_ready_cb_(packet_cb){};
-  void OnDataReady(int fd, HciPacketType packet_type);
-  const hidl_vec<uint8_t>& GetPacket() const;
+  HciPacketizer(HciPacketPool& pool, HciPacketReadyCallback packet_cb)
+      : pool_(pool), packet_ready_cb_(packet_cb){};
+
+  // If data starts with a whole packet of the given type, copies it into a
+  // pool packet, hands that to the packet ready callback and returns its size.
+  // The callback owns the packet and returns it to the pool. Returns 0 while
+  // the packet is still incomplete or no pool packet is free; the caller keeps
+  // the bytes and retries later.
+  size_t OnDataReady(const uint8_t* data, size_t length,
+                     HciPacketType packet_type);
 
  protected:
-  enum State { HCI_PREAMBLE, HCI_PAYLOAD };
-  State state_{HCI_PREAMBLE};
-  uint8_t preamble_[HCI_PREAMBLE_SIZE_MAX];
-  hidl_vec<uint8_t> packet_;
-  size_t bytes_remaining_{0};
-  size_t bytes_read_{0};
+  HciPacketPool& pool_;
   HciPacketReadyCallback packet_ready_cb_;
 };
 
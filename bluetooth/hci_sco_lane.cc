@@ -0,0 +1,139 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_sco_lane.h"
+
+#define LOG_TAG "android.hardware.bluetooth-hci-sco_lane"
+#include <sched.h>
+#include <string.h>
+#include <utils/Log.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+// Arrival gaps longer than this are pauses in the call, not packet spacing.
+const int64_t kMaxIntervalNs = 100000000;
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciScoLane::HciScoLane(HciPacketPool& pool, HciPacketDeliverCallback deliver_cb,
+                       size_t jitter_depth)
+    : pool_(pool),
+      deliver_cb_(deliver_cb),
+      jitter_depth_(std::min(jitter_depth, kQueueSize / 2)) {
+  thread_ = std::thread([this]() { ThreadRoutine(); });
+}
+
+HciScoLane::~HciScoLane() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    exit_ = true;
+  }
+  not_empty_.notify_one();
+  if (thread_.joinable()) thread_.join();
+
+  HciPacket* packet;
+  while ((packet = queue_.Pop()) != nullptr) pool_.Release(packet);
+
+  ALOGI(
+      "%s: %zu packets delivered, high water mark %zu/%zu, %zu dropped, %zu "
+      "underruns, interval %lld us",
+      __func__, delivered_, high_water_, kQueueSize, drops_, underruns_,
+      static_cast<long long>(interval_ns_ / 1000));
+}
+
+void HciScoLane::Post(HciPacket* packet) {
+  if (!queue_.Push(packet)) {
+    drops_++;
+    pool_.Release(packet);
+    return;
+  }
+  high_water_ = std::max(high_water_, queue_.Size());
+
+  if (consumer_waiting_) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    not_empty_.notify_one();
+  }
+}
+
+// Runs on the lane thread only.
+void HciScoLane::UpdateInterval(int64_t timestamp_ns) {
+  int64_t delta = timestamp_ns - last_timestamp_ns_;
+  last_timestamp_ns_ = timestamp_ns;
+  if (delta < 0 || delta > kMaxIntervalNs) return;
+  // Packets read together arrive with no spacing and the next ones late, the
+  // average still converges on the real interval.
+  interval_ns_ += (delta - interval_ns_) / 16;
+}
+
+void HciScoLane::ThreadRoutine() {
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  param.sched_priority = kThreadPriority;
+  if (sched_setscheduler(0, SCHED_FIFO, &param))
+    ALOGW("%s: can't use SCHED_FIFO (%s)", __func__, strerror(errno));
+
+  bool started = false;
+  auto deadline = std::chrono::steady_clock::now();
+
+  std::unique_lock<std::mutex> guard(mutex_);
+  while (true) {
+    if (!started) {
+      // (Re)fill the jitter buffer before delivering.
+      size_t fill = std::max<size_t>(jitter_depth_, 1);
+      consumer_waiting_ = true;
+      not_empty_.wait(guard,
+                      [this, fill] { return exit_ || queue_.Size() >= fill; });
+      consumer_waiting_ = false;
+      started = true;
+      deadline = std::chrono::steady_clock::now();
+    } else if (jitter_depth_ > 0) {
+      not_empty_.wait_until(guard, deadline, [this] { return exit_; });
+    }
+    if (exit_) break;
+
+    HciPacket* packet = queue_.Pop();
+    if (packet == nullptr) {
+      if (jitter_depth_ > 0) underruns_++;
+      started = false;
+      continue;
+    }
+
+    guard.unlock();
+    UpdateInterval(packet->timestamp_ns);
+    deliver_cb_(packet);
+    delivered_++;
+    guard.lock();
+
+    auto now = std::chrono::steady_clock::now();
+    deadline += std::chrono::nanoseconds(interval_ns_);
+    // Catch up after a stall, or when the controller runs faster than the
+    // estimate and the buffer grows past its depth.
+    if (deadline < now || queue_.Size() > jitter_depth_) deadline = now;
+  }
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
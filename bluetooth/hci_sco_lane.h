@@ -0,0 +1,81 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "hci_dispatcher.h"
+#include "hci_packet_pool.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// Delivers received SCO packets from their own SCHED_FIFO thread, so voice
+// never waits behind events or bulk ACL data. With a non-zero jitter depth,
+// that many packets are buffered before delivery starts and packets are then
+// released at the rate they arrive on average, smoothing out UART bursts.
+class HciScoLane {
+ public:
+  static const size_t kQueueSize = 16;
+  static const int kThreadPriority = 2;
+
+  HciScoLane(HciPacketPool& pool, HciPacketDeliverCallback deliver_cb,
+             size_t jitter_depth);
+  ~HciScoLane();
+
+  // Called from the reader thread. Drops the packet if the lane is full.
+  void Post(HciPacket* packet);
+
+ private:
+  HciScoLane(const HciScoLane&) = delete;
+  HciScoLane& operator=(const HciScoLane&) = delete;
+
+  void ThreadRoutine();
+  void UpdateInterval(int64_t timestamp_ns);
+
+  HciPacketPool& pool_;
+  HciPacketDeliverCallback deliver_cb_;
+  const size_t jitter_depth_;
+
+  HciPacketQueue<kQueueSize> queue_;
+
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::atomic_bool consumer_waiting_{false};
+  bool exit_{false};
+  std::thread thread_;
+
+  // Average packet spacing, starting from one HV3 packet per 7.5 ms.
+  int64_t interval_ns_{7500000};
+  int64_t last_timestamp_ns_{0};
+
+  // Statistics, logged when the lane is destroyed.
+  size_t high_water_{0};
+  size_t drops_{0};
+  size_t underruns_{0};
+  size_t delivered_{0};
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,291 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "hci_tx_queue.h"
+#include "hci_packetizer.h"
+
+#define LOG_TAG "android.hardware.bluetooth-hci-tx_queue"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <utils/Log.h>
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+
+// How long the destructor waits for the UART to take the queued frames.
+const int kFlushTimeoutMs = 500;
+
+}  // namespace
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+HciTxQueue::HciTxQueue(int fd, size_t capacity)
+    : uart_fd_(fd), ring_(capacity) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK))
+    ALOGE("%s: can't make fd %d non-blocking (%s)", __func__, fd,
+          strerror(errno));
+}
+
+HciTxQueue::~HciTxQueue() {
+  {
+    std::unique_lock<std::mutex> guard(mutex_);
+    exit_ = true;
+    not_full_.notify_all();
+
+    // Wait for the UART only when there is something left to write.
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(kFlushTimeoutMs);
+    while (pending_ && !Flush()) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      if (left.count() <= 0) {
+        ALOGE("%s: dropped %zu queued bytes", __func__, size_);
+        break;
+      }
+      guard.unlock();
+      struct pollfd pfd = {uart_fd_, POLLOUT, 0};
+      TEMP_FAILURE_RETRY(poll(&pfd, 1, left.count()));
+      guard.lock();
+    }
+  }
+
+  ALOGI("%s: %zu frames in %zu writes (max %zu per batch), %zu full waits",
+        __func__, frames_written_, writes_, max_frames_per_write_,
+        full_waits_);
+  ALOGI("%s: %zu writes would have blocked, %zu SCO frames, %zu priority "
+        "slot waits",
+        __func__, would_block_, sco_frames_written_, sco_slot_waits_);
+}
+
+void HciTxQueue::SetWriteWatch(HciWriteWatchCallback watch_cb) {
+  {
+    std::unique_lock<std::mutex> guard(watch_mutex_);
+    watch_cb_ = watch_cb;
+    watching_ = false;
+  }
+  UpdateWriteWatch();
+}
+
+void HciTxQueue::UpdateWriteWatch() {
+  std::unique_lock<std::mutex> guard(watch_mutex_);
+  if (!watch_cb_ || watching_ == pending_) return;
+  watching_ = pending_;
+  watch_cb_(watching_);
+}
+
+void HciTxQueue::Push(const uint8_t* data, size_t length) {
+  size_t tail = (head_ + size_) % ring_.size();
+  size_t first = std::min(length, ring_.size() - tail);
+  memcpy(ring_.data() + tail, data, first);
+  memcpy(ring_.data(), data + first, length - first);
+  size_ += length;
+}
+
+size_t HciTxQueue::SendSco(const uint8_t* data, size_t length) {
+  if (1 + length > sizeof(sco_slot_)) {
+    ALOGE("%s: %zu byte SCO frame is too large", __func__, length);
+    return 0;
+  }
+
+  std::unique_lock<std::mutex> guard(mutex_);
+  if (sco_slot_length_ != 0) {
+    sco_slot_waits_++;
+    not_full_.wait(guard, [this] { return exit_ || sco_slot_length_ == 0; });
+    if (exit_) return 0;
+  }
+  sco_slot_[0] = HCI_PACKET_TYPE_SCO_DATA;
+  memcpy(sco_slot_ + 1, data, length);
+  sco_slot_length_ = 1 + length;
+  pending_ = true;
+  if (batch_count_ == 0) Flush();
+  guard.unlock();
+  UpdateWriteWatch();
+  return length;
+}
+
+size_t HciTxQueue::Send(uint8_t type, const uint8_t* data, size_t length) {
+  if (type == HCI_PACKET_TYPE_SCO_DATA) return SendSco(data, length);
+
+  size_t frame_size = sizeof(type) + length;
+  if (frame_size > ring_.size()) {
+    ALOGE("%s: %zu byte frame does not fit the queue", __func__, frame_size);
+    return 0;
+  }
+
+  std::unique_lock<std::mutex> guard(mutex_);
+  if (ring_.size() - size_ < frame_size) {
+    full_waits_++;
+    not_full_.wait(guard, [this, frame_size] {
+      return exit_ || ring_.size() - size_ >= frame_size;
+    });
+    if (exit_) return 0;
+  }
+  Push(&type, sizeof(type));
+  Push(data, length);
+  frames_++;
+  pending_ = true;
+  // A batch still in progress means the UART is full: the watcher will
+  // continue when it drains.
+  if (batch_count_ == 0) Flush();
+  guard.unlock();
+  UpdateWriteWatch();
+  return length;
+}
+
+void HciTxQueue::OnWriteReady() {
+  if (pending_) {
+    std::unique_lock<std::mutex> guard(mutex_);
+    Flush();
+  }
+  UpdateWriteWatch();
+}
+
+// Called with mutex_ held.
+size_t HciTxQueue::FrameSizeAt(size_t offset) const {
+  uint8_t frame[1 + HCI_PREAMBLE_SIZE_MAX] = {};
+  for (size_t i = 0; i < sizeof(frame) && offset + i < size_; i++)
+    frame[i] = ring_[(head_ + offset + i) % ring_.size()];
+  HciPacketType type = static_cast<HciPacketType>(frame[0]);
+  return 1 + HciGetPreambleSizeForType(type) +
+         HciGetPacketLengthForType(type, frame + 1);
+}
+
+// Called with mutex_ held, while a batch without the SCO slot is partly
+// written.
+void HciTxQueue::CutBatchForSco() {
+  size_t left = 0;
+  for (int i = 0; i < batch_count_; i++) left += batch_[i].iov_len;
+  size_t written = batch_ring_bytes_ - left;
+
+  // Find the end of the frame on the wire.
+  size_t end = 0;
+  size_t frames = 0;
+  while (end < written) {
+    end += FrameSizeAt(end);
+    frames++;
+  }
+  if (end >= batch_ring_bytes_) return;
+
+  batch_count_ = 0;
+  size_t start = (head_ + written) % ring_.size();
+  size_t first = std::min(end - written, ring_.size() - start);
+  if (first > 0) {
+    batch_[batch_count_].iov_base = ring_.data() + start;
+    batch_[batch_count_++].iov_len = first;
+  }
+  if (end - written > first) {
+    batch_[batch_count_].iov_base = ring_.data();
+    batch_[batch_count_++].iov_len = end - written - first;
+  }
+  frames_ += batch_frames_ - frames;
+  batch_frames_ = frames;
+  batch_ring_bytes_ = end;
+}
+
+// Called with mutex_ held.
+void HciTxQueue::FinishBatch() {
+  head_ = (head_ + batch_ring_bytes_) % ring_.size();
+  size_ -= batch_ring_bytes_;
+  if (batch_sco_) {
+    sco_slot_length_ = 0;
+    sco_frames_written_++;
+  }
+  frames_written_ += batch_frames_;
+  max_frames_per_write_ = std::max(max_frames_per_write_, batch_frames_);
+  not_full_.notify_all();
+}
+
+// Called with mutex_ held.
+bool HciTxQueue::Flush() {
+  while (true) {
+    if (batch_count_ > 0 && sco_slot_length_ > 0 && !batch_sco_) {
+      CutBatchForSco();
+      // The cut fell right where the UART stopped.
+      if (batch_count_ == 0) {
+        FinishBatch();
+        continue;
+      }
+    }
+
+    if (batch_count_ == 0) {
+      if (size_ == 0 && sco_slot_length_ == 0) {
+        pending_ = false;
+        return true;
+      }
+
+      // Everything queued so far goes out as one batch, a pending SCO frame
+      // first. The ring is only appended to and the slot is left alone while
+      // it is full, so the batch stays valid until it is written.
+      batch_sco_ = sco_slot_length_ > 0;
+      if (batch_sco_) {
+        batch_[batch_count_].iov_base = sco_slot_;
+        batch_[batch_count_++].iov_len = sco_slot_length_;
+      }
+      size_t first = std::min(size_, ring_.size() - head_);
+      if (first > 0) {
+        batch_[batch_count_].iov_base = ring_.data() + head_;
+        batch_[batch_count_++].iov_len = first;
+      }
+      if (size_ > first) {
+        batch_[batch_count_].iov_base = ring_.data();
+        batch_[batch_count_++].iov_len = size_ - first;
+      }
+      batch_ring_bytes_ = size_;
+      batch_frames_ = frames_ + (batch_sco_ ? 1 : 0);
+      frames_ = 0;
+    }
+
+    ssize_t ret = TEMP_FAILURE_RETRY(writev(uart_fd_, batch_, batch_count_));
+    if (ret < 0 && errno != EAGAIN) {
+      ALOGE("%s: dropped a batch of %zu frames (%s)", __func__, batch_frames_,
+            strerror(errno));
+      batch_count_ = 0;
+    } else if (ret <= 0) {
+      would_block_++;
+      return false;
+    } else {
+      writes_++;
+      // Skip what was written, keeping the rest of the batch in order.
+      size_t written = ret;
+      int done = 0;
+      while (done < batch_count_ && written >= batch_[done].iov_len)
+        written -= batch_[done++].iov_len;
+      if (done < batch_count_) {
+        batch_[done].iov_base =
+            static_cast<uint8_t*>(batch_[done].iov_base) + written;
+        batch_[done].iov_len -= written;
+      }
+      std::copy(batch_ + done, batch_ + batch_count_, batch_);
+      batch_count_ -= done;
+      if (batch_count_ > 0) continue;
+    }
+
+    FinishBatch();
+  }
+}
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,129 @@
+//
+// Copyright 2017 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+
+#include <sys/uio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "hci_internals.h"
+
+namespace android {
+namespace hardware {
+namespace bluetooth {
+namespace hci {
+
+// Enables or disables the write readiness watch of the UART.
+using HciWriteWatchCallback = std::function<void(bool enable)>;
+
+// Output queue owning the UART writes. The UART is put in non-blocking mode
+// and frames are copied into a byte ring; whatever the UART accepts is
+// written right away by the sender and the rest is written by the fd
+// watcher thread calling OnWriteReady when the UART has room again. The
+// watch is only enabled while the queue holds data. Frames
+// that pile up meanwhile go out together in one writev. SCO frames bypass the
+// ring through a single priority slot that is written right after the frame
+// on the wire, ahead of any other queued data.
+class HciTxQueue {
+ public:
+  // Large enough for two maximum-size ACL frames.
+  static const size_t kDefaultCapacity =
+      2 * (1 + HCI_ACL_PREAMBLE_SIZE + 0xFFFF);
+
+  HciTxQueue(int fd, size_t capacity = kDefaultCapacity);
+  // Waits a short while for queued frames to be written, if there are any.
+  ~HciTxQueue();
+
+  // watch_cb is called with true when a write would block and with false
+  // once the queue is empty. Enabling the watch must report the UART as
+  // writable if it already is, which epoll does for level-triggered watches
+  // and when a watch is modified. nullptr stops the calls.
+  void SetWriteWatch(HciWriteWatchCallback watch_cb);
+
+  // Queues an H4 frame. Blocks only while the ring, or for SCO the priority
+  // slot, is full, so it must not be called from the thread that calls
+  // OnWriteReady.
+  size_t Send(uint8_t type, const uint8_t* data, size_t length);
+
+  // Called when the UART is writable.
+  void OnWriteReady();
+
+ private:
+  HciTxQueue(const HciTxQueue&) = delete;
+  HciTxQueue& operator=(const HciTxQueue&) = delete;
+
+  void Push(const uint8_t* data, size_t length);
+  size_t SendSco(const uint8_t* data, size_t length);
+  // Writes as much as the UART takes. Returns true once nothing is pending.
+  bool Flush();
+  // Size of the queued frame starting offset bytes after head_.
+  size_t FrameSizeAt(size_t offset) const;
+  // Ends a partly written batch with the frame being written, so that a
+  // waiting SCO frame goes next.
+  void CutBatchForSco();
+  // Releases the ring bytes and the SCO slot of a written batch.
+  void FinishBatch();
+  // Called without mutex_ held after pending_ may have changed.
+  void UpdateWriteWatch();
+
+  int uart_fd_;
+  std::vector<uint8_t> ring_;
+  size_t head_{0};
+  size_t size_{0};
+  size_t frames_{0};
+  bool exit_{false};
+  // Lets OnWriteReady skip the lock when there is nothing to write.
+  std::atomic_bool pending_{false};
+
+  uint8_t sco_slot_[1 + HCI_SCO_PREAMBLE_SIZE + 0xFF];
+  size_t sco_slot_length_{0};
+
+  // The frames being written. A batch is finished before the next one is
+  // started, so a SCO frame never lands in the middle of a partly written
+  // frame; a SCO frame only waits for the end of the frame on the wire.
+  struct iovec batch_[3];
+  int batch_count_{0};
+  size_t batch_ring_bytes_{0};
+  size_t batch_frames_{0};
+  bool batch_sco_{false};
+
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+
+  // Serializes the watch updates, so the last one matches pending_.
+  std::mutex watch_mutex_;
+  HciWriteWatchCallback watch_cb_;
+  bool watching_{false};
+
+  // Statistics, logged when the queue is destroyed.
+  size_t writes_{0};
+  size_t frames_written_{0};
+  size_t max_frames_per_write_{0};
+  size_t full_waits_{0};
+  size_t would_block_{0};
+  size_t sco_frames_written_{0};
+  size_t sco_slot_waits_{0};
+};
+
+}  // namespace hci
+}  // namespace bluetooth
+}  // namespace hardware
+}  // namespace android
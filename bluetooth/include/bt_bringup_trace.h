@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BT_BRINGUP_TRACE_H
+#define BT_BRINGUP_TRACE_H
+
+/*
+ * Bring-up markers shared by uim and the Bluetooth HAL. Each phase of
+ * getting the controller ready is stamped with CLOCK_MONOTONIC and written,
+ * as one line, to the tracefs marker and to the bt_bringup log tag:
+ *
+ *   bt_bringup: source=<uim|hal> t=<ns> phase=<phase>
+ *
+ * Both processes use the same clock, so hikey_bt_bringup_replay can put
+ * their marks on one timeline per boot, from logcat or from a trace.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+
+#define BT_BRINGUP_TAG "bt_bringup"
+
+static inline int64_t bt_bringup_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Marks are rare, so the marker is opened for each of them. Nothing is
+ * written there when tracefs is not mounted or not writable.
+ */
+static inline void bt_bringup_trace_write(const char *line, int length)
+{
+	static const char *const markers[] = {
+		"/sys/kernel/tracing/trace_marker",
+		"/sys/kernel/debug/tracing/trace_marker",
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(markers) / sizeof(markers[0]); i++) {
+		int fd = open(markers[i], O_WRONLY | O_CLOEXEC);
+
+		if (fd < 0)
+			continue;
+		if (write(fd, line, length) < 0) {
+			/* nothing else to do about it */
+		}
+		close(fd);
+		return;
+	}
+}
+
+/* Records a bring-up phase of source and returns its timestamp. */
+static inline int64_t bt_bringup_mark(const char *source, const char *phase)
+{
+	int64_t now = bt_bringup_now_ns();
+	char line[160];
+	int length;
+
+	length = snprintf(line, sizeof(line),
+			  BT_BRINGUP_TAG ": source=%s t=%lld phase=%s\n",
+			  source, (long long)now, phase);
+	if (length >= (int)sizeof(line))
+		length = sizeof(line) - 1;
+	if (length > 0)
+		bt_bringup_trace_write(line, length);
+#ifdef __ANDROID__
+	__android_log_print(ANDROID_LOG_INFO, BT_BRINGUP_TAG,
+			    "source=%s t=%lld phase=%s", source,
+			    (long long)now, phase);
+#endif
+	return now;
+}
+
+#endif /* BT_BRINGUP_TRACE_H */
@@ -11,18 +11,19 @@
  * Control protocols provided by Paul Cotter.
  */
 
-#include <list>
 #include <iostream>
-#include <sstream>
 #include <string>
 #include <map>
 #include <stdio.h>
 #include <termios.h>
+#include <android/log.h>
 #include "hddefs.h"
 #include "hdlinuxio.h"
 #include "hdcommands.h"
 #include "hdlisten.h"
 
+#define  LOGD(...)  __android_log_print(ANDROID_LOG_DEBUG,"RADIO",__VA_ARGS__)
+
 //Leave these comments in place -- the original author uses them with a
 //Perl script to generate headers
 
@@ -90,81 +91,64 @@ void HDCommands::setstreamwait(int wait) {//public
 }
 
 /**
-	Send the actual command to the radio.  The data is passed to us
-	in a list of strings.  We go through each string, add all the hex
-	numbers into a long string and total their values to use in the
-	checksum.  (We use them in a string because it's easier to enter
-	them into maps and other info as humans and it lets us easily print
-	them out for reference, as well as defining one standard way to store
-	them.)
-	@param inlist list of different hex strings to send to the radio
+ * Add a byte of a command to the buffer, escaping it if needed.  0x1B is
+ * escaped everywhere after the header, 0xA4 only in the body.
+ * @param out where to add the byte
+ * @param byte the byte
+ * @param body true if the byte is in the body
+ * @return where to add the next byte
+ */
+static unsigned char* putbyte(unsigned char* out, unsigned char byte, bool body) {
+	if (byte == HDESCAPE || (byte == HDFRAMEHEADER && body)) {
+		*out++ = HDESCAPE;
+		if (byte == HDFRAMEHEADER)
+			byte = HDESCAPEDHEADER;
+	}
+	*out++ = byte;
+	return out;
+}
+
+/**
+	Send the actual command to the radio.  The frame is built straight
+	into our buffer, escaped as it goes, with the checksum summed along
+	the way, and written to the port at once.
+	@param command the command to send
+	@param op the operation (set or get)
+	@param args the 4 byte arguments, sent little endian
+	@param nargs the number of arguments, at most HDMAXARGS
 */
-void HDCommands::sendcommand(list<string> inlist) {//private
-	int msgout = 0, msglen = 0;
-	char byte;
-	char hbyte [10];
-	int dec, count = 0, csum = 0;
-	string cmd = "", ref = "", line;
-	list<int> iout;
-	list<string>::iterator x;
-
-	for (x = inlist.begin(); x != inlist.end(); ++x) {
-		line = *x;
-		istringstream iss(line);
-		do {
-			dec = -1;
-			iss >> hex >> dec;
-			if (dec < 0) {
-				break;
-			}
-			count++;
-			csum += dec;
-		} while (dec >= 0);
-		ref += " ";
-		ref += line;
+void HDCommands::sendcommand(HDCommand command, HDOperation op, const uint32_t* args, int nargs) {//private
+	unsigned char *out = txbuf, cs, byte;
+	int i, j;
+
+	if (command >= HD_NUMCOMMANDS || nargs > HDMAXARGS)
+		return;
+
+	*out++ = HDFRAMEHEADER;
+	byte = 2 + 2 + 4 * nargs;
+	cs = HDFRAMEHEADER + byte;
+	out = putbyte(out, byte, false);
+	for (i = 0; i < 2; i++) {
+		byte = hd_commandtable[command].code[i];
+		cs += byte;
+		out = putbyte(out, byte, true);
 	}
-	csum += count;
-	msglen = count + 3;
-	sprintf(hbyte, "0x%2X", count);
-	if (hbyte[2] == ' ')
-		hbyte[2] = '0';
-	line = ref;
-// 	ref = hdconstants["begincommand"];
-	ref = hdvals->getconstant("begincommand");
-	istringstream istr(ref);
-	istr >> hex >> dec;
-	csum += dec;
-	csum = csum % 256;
-	ref += " ";
-	ref += hbyte;
-	ref += line;
-	sprintf(hbyte, "0x%2X", csum);
-	if (hbyte[2] == ' ')
-		hbyte[2] = '0';
-	ref += " ";
-	ref += hbyte;
-	istringstream iscmd(ref);
-	do {
-		dec = - 1;
-		iscmd >> hex >> dec;
-		if (dec < 0)
-			break;
-// 		cout << "\tConverting to byte: " << dec << endl;
-		byte = dec;
-		if (dec == 0x1B || (dec == 0xA4 && (msgout > 1 && msgout < msglen - 1))) {
-// 			cout << "Sending escape byte.\n";
-			ioport->hdsendbyte(0x1B);
-			if (dec == 0xA4) {
-				dec = 0x48;
-				byte = dec;
-// 				cout << "Changing value to: " << dec << endl;
-			}
+	for (i = 0; i < 2; i++) {
+		byte = op >> (8 * i);
+		cs += byte;
+		out = putbyte(out, byte, true);
+	}
+	for (i = 0; i < nargs; i++) {
+		for (j = 0; j < 4; j++) {
+			byte = args[i] >> (8 * j);
+			cs += byte;
+			out = putbyte(out, byte, true);
 		}
-		ioport->hdsendbyte(byte);
-		msgout++;
-	} while (dec >= 0);;
-// 	cout << "Command sent\n";
-	if (verbose) cout << "\tCommand bytes: " << ref << ", Length: " << msglen << endl;
+	}
+	out = putbyte(out, cs, false);
+
+	ioport->hdsendbytes(txbuf, out - txbuf);
+	if (verbose) cout << "\tCommand: " << hd_commandtable[command].name << ", Bytes sent: " << out - txbuf << endl;
 	return;
 }
 
@@ -208,11 +192,10 @@ string HDCommands::getnum(string str, int ipos) {//private
  * @param pmode Either "on" or "off" to turn the power to that state.
  */
 void HDCommands::hd_power(string pmode) {//public
-	list<string> cmd;
-	cmd.push_back(hdvals->getcode("power"));
-	cmd.push_back(hdvals->getop("set"));
-	cmd.push_back(hdvals->getconstant(pmode));
-	sendcommand(cmd);
+	uint32_t arg;
+	if (!hd_findconstant(pmode.c_str(), &arg))
+		return;
+	sendcommand(HD_POWER, HD_SET, &arg, 1);
 	return;
 }
 
@@ -221,20 +204,16 @@ void HDCommands::hd_power(string pmode) {//public
  * @param mmode Either "on" or "off" to turn the mute to that state.
  */
 void HDCommands::hd_mute(string mmode) {//public
-	list<string> cmd;
-	cmd.push_back(hdvals->getcode("mute"));
-	cmd.push_back(hdvals->getop("set"));
-	cmd.push_back(hdvals->getconstant(mmode));
-	sendcommand(cmd);
+	uint32_t arg;
+	if (!hd_findconstant(mmode.c_str(), &arg))
+		return;
+	sendcommand(HD_MUTE, HD_SET, &arg, 1);
 	return;
 }
 
 void HDCommands::hd_disable(){
-	list<string> cmd;
-	cmd.push_back(hdvals->getcode("hdenablehdtuner"));
-	cmd.push_back(hdvals->getop("set"));
-	cmd.push_back(hdvals->getconstant("off"));
-	sendcommand(cmd);
+	const uint32_t arg = HD_ZERO;
+	sendcommand(HD_HDENABLEHDTUNER, HD_SET, &arg, 1);
 	return;
 }
 
@@ -245,9 +224,8 @@ void HDCommands::hd_disable(){
  * @param scale 0 if no scale is used, otherwise the top number in the scale
  */
 void HDCommands::hd_setitem(string setname, int level, int scale) {//public
-	char hexnum[5];
-	string newlevel = "";
-	list<string> cmd;
+	HDCommand command = hd_findcommand(setname.c_str());
+	uint32_t arg;
 
 	if (verbose) cout << "Setting item: " << setname << ", Value: " << level;
 
@@ -258,18 +236,9 @@ void HDCommands::hd_setitem(string setname, int level, int scale) {//public
 		}
 	}
 	if (verbose) cout << ", Converted value: " << level << endl;
-	sprintf(hexnum, "0x%2X", level);
-	if (hexnum[2] == ' ')
-		hexnum[2] = '0';
-	newlevel = hexnum;
-	newlevel += " 0x00 0x00 0x00";
-// 	cout << "Set name: " << setname << ", Bytes: " << hdcmds[setname] << endl;
-	cmd.push_back(hdvals->getcode(setname));
-// 	cout << "Set: " << hdops["set"] << endl;
-	cmd.push_back(hdvals->getop("set"));
-// 	cout << "New setting: " << newlevel << endl;
-	cmd.push_back(newlevel);
-	sendcommand(cmd);
+	// Only the low byte of the level is used.
+	arg = level & 0xFF;
+	sendcommand(command, HD_SET, &arg, 1);
 	return;
 }
 
@@ -373,42 +342,20 @@ bool HDCommands::hd_tune(int freq, int channel, int band){
 bool HDCommands::hd_tune(int newfreq, int newchannel, string newband) {//public
 // 	cout << "Tune, 3 args, final, Freq: " << newfreq << ", Channel: " << newchannel << ", Band: " << newband << endl;
 	char chanxfer[10];
-	unsigned int x;
 	double itime;
-	list<string> cmd;
-	char xfer;
-	char hexfreq [8] = "000000";
-	string hex = "", oldfreq, checkchan;
+	uint32_t args[3];
+	string checkchan;
 	time_t tstart, tnow;
 
-	if (newband == "FM")
-		newband = "fm";
-	if (newband == "AM")
-		newband = "am";
-	cmd.push_back(hdvals->getcode("tune"));
-	cmd.push_back(hdvals->getop("set"));
-	cmd.push_back(hdvals->getband(newband));
-	sprintf(hexfreq, "%4X", newfreq);
-//There has GOT to be a "C++" way of doing this easily: reverse the hex
-//bytes and replace blanks and spaces with 0.
-	for (x = 0; x < sizeof(hexfreq); x++) {
-		if (hexfreq[x] == 000 || hexfreq[x] == ' ')
-			hexfreq[x] = '0';
-		if (x < 2) {
-			xfer = hexfreq[x + 2];
-			hexfreq[x + 2] = hexfreq[x];
-			hexfreq[x] = xfer;
-		}
-		if (x % 2 == 0) {
-			if (x > 0)
-				hex += " ";
-			hex += "0x";
-		}
-		hex += hexfreq[x];
-	}
-	cmd.push_back(hex);
-	cmd.push_back(hdvals->getconstant("zero"));
-	sendcommand(cmd);
+	if (newband == "FM" || newband == "fm")
+		args[0] = HD_FM;
+	else if (newband == "AM" || newband == "am")
+		args[0] = HD_AM;
+	else
+		return false;
+	args[1] = newfreq & 0xFFFF;
+	args[2] = HD_ZERO;
+	sendcommand(HD_TUNE, HD_SET, args, 3);
 	if (newchannel != 0) {
 		sprintf(chanxfer, "%d", newchannel);
 		checkchan = chanxfer;
@@ -438,13 +385,10 @@ bool HDCommands::hd_tune(int newfreq, int newchannel, string newband) {//public
  * @param tunedir either "up" or "down" for the direction to tune
  */
 void HDCommands::hd_tuneupdown(string tunedir) {//public
-	list<string> cmd;
-	cmd.push_back(hdvals->getcode("tune"));
-	cmd.push_back(hdvals->getop("set"));
-	cmd.push_back(hdvals->getconstant("zero"));
-	cmd.push_back(hdvals->getconstant("zero"));
-	cmd.push_back(hdvals->getconstant(tunedir));
-	sendcommand(cmd);
+	uint32_t args[3] = { HD_ZERO, HD_ZERO, HD_ZERO };
+	if (!hd_findconstant(tunedir.c_str(), &args[2]))
+		return;
+	sendcommand(HD_TUNE, HD_SET, args, 3);
 	return;
 }
 
@@ -454,19 +398,12 @@ void HDCommands::hd_tuneupdown(string tunedir) {//public
  * @param seek_dir direction ("up" or "down") to seek for a new station
  */
 void HDCommands::hd_seekupdown(string seek_dir) {//public
-	list<string> cmd;
-	cmd.push_back(hdvals->getcode("seek"));
-	cmd.push_back(hdvals->getop("set"));
-	cmd.push_back("0xA5 0x00 0x00 0x00");
-	cmd.push_back(hdvals->getconstant("zero"));
-	cmd.push_back(hdvals->getconstant(seek_dir));
-	if (seekall) {
-		cmd.push_back("0x00 0x00 0x3D 0x00");
-	} else {
-		cmd.push_back("0x00 0x00 0x3D 0x01");
-	}
-	cmd.push_back(hdvals->getconstant("zero"));
-	sendcommand(cmd);
+	uint32_t args[5] = { 0x000000A5, HD_ZERO, HD_ZERO, 0x003D0000, HD_ZERO };
+	if (!hd_findconstant(seek_dir.c_str(), &args[2]))
+		return;
+	if (!seekall)
+		args[3] |= 0x01000000;
+	sendcommand(HD_SEEK, HD_SET, args, 5);
 	return;
 }
 
@@ -476,10 +413,12 @@ void HDCommands::hd_seekupdown(string seek_dir) {//public
  * @param mode the mode to ask the radio to return
  */
 void HDCommands::hdget(string mode) {//public
-	list<string> cmd;
-	cmd.push_back(hdvals->getcode(mode));
-	cmd.push_back(hdvals->getop("get"));
-	sendcommand(cmd);
+	HDCommand command = hd_findcommand(mode.c_str());
+	if (command == HD_NUMCOMMANDS) {
+		LOGD("No radio command for %s", mode.c_str());
+		return;
+	}
+	sendcommand(command, HD_GET, NULL, 0);
 }
 
 /**
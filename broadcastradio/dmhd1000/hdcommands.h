@@ -1,9 +1,7 @@
 #ifndef MYFILE_HDCOMMANDS
 #define MYFILE_HDCOMMANDS
 
-#include <list>
 #include <iostream>
-#include <sstream>
 #include <string>
 #include <map>
 #include <termios.h>
@@ -13,12 +11,18 @@
 
 using namespace std;
 
+// Most 4 byte arguments a command takes.
+#define HDMAXARGS 5
+
 class HDCommands {
 		 bool seekall, verbose;
 		 int streamlockwait;
 		 LinuxPort* ioport;
 		 HDListen* hdlisten;
 		 HDVals* hdvals;
+		 // The command being sent, escaped: header, length, code, operation,
+		 // up to HDMAXARGS arguments and the checksum.
+		 unsigned char txbuf[1 + 2 * (1 + 2 + 2 + 4 * HDMAXARGS + 1)];
 
 	public:
 		HDCommands();
@@ -46,7 +50,7 @@ class HDCommands {
 	protected:
 
 	private:
-		void sendcommand(list<string>);
+		void sendcommand(HDCommand, HDOperation, const uint32_t*, int);
 		string removedecimal(string);
 		string getnum(string, int);
 
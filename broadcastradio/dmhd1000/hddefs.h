@@ -1,33 +1,194 @@
 #ifndef MYFILE_HDDEFS
 #define MYFILE_HDDEFS
 
+#include <stdint.h>
 #include <string>
 #include <map>
 #include <iostream>
 
 using namespace std;
 
+/**
+ * Commands the radio takes.  Its replies carry the same codes.
+ */
+enum HDCommand {
+	HD_POWER, HD_MUTE,
+	HD_SIGNALSTRENGTH, HD_TUNE, HD_SEEK,
+	HD_HDACTIVE, HD_HDSTREAMLOCK, HD_HDSIGNALSTRENGTH, HD_HDSUBCHANNEL,
+	HD_HDSUBCHANNELCOUNT, HD_HDENABLEHDTUNER, HD_HDTITLE, HD_HDARTIST,
+	HD_HDCALLSIGN, HD_HDSTATIONNAME, HD_HDUNIQUEID, HD_HDAPIVERSION,
+	HD_HDHWVERSION,
+	HD_RDSENABLE, HD_RDSUNKNOWN1, HD_RDSUNKNOWN2, HD_RDSUNKNOWN3,
+	HD_RDSUNKNOWN4, HD_RDSUNKNOWN5, HD_RDSGENRE, HD_RDSPROGRAMSERVICE,
+	HD_RDSRADIOTEXT,
+	HD_UNKNOWN1, HD_UNKNOWN2, HD_VOLUME, HD_BASS, HD_TREBLE, HD_COMPRESSION,
+	HD_NUMCOMMANDS
+};
+
+/**
+ * Operations, sent as 2 bytes, little endian, after the command code.
+ */
+enum HDOperation {
+	HD_SET = 0x0000,
+	HD_GET = 0x0001,
+	HD_REPLY = 0x0002
+};
+
+/**
+ * How the value in a reply is laid out after the operation.
+ */
+enum HDFormat {
+	HD_FORMAT_NONE,
+	HD_FORMAT_BOOLEAN,	// 4 bytes
+	HD_FORMAT_INT,		// 4 bytes, only the low 2 are used
+	HD_FORMAT_STRING,	// 4 byte length, then the text
+	HD_FORMAT_BANDINT,	// 4 byte band, then a 4 byte frequency
+	HD_FORMAT_INTSTRING	// subchannel, then a string
+};
+
+struct HDCommandDef {
+	HDCommand command;
+	const char* name;
+	unsigned char code[2];
+	HDFormat format;
+};
+
+/**
+ * Name, code and reply format of every command, in the order of HDCommand.
+ */
+constexpr HDCommandDef hd_commandtable[HD_NUMCOMMANDS] = {
+	{ HD_POWER, "power", { 0x01, 0x00 }, HD_FORMAT_BOOLEAN },
+	{ HD_MUTE, "mute", { 0x02, 0x00 }, HD_FORMAT_BOOLEAN },
+	{ HD_SIGNALSTRENGTH, "signalstrength", { 0x01, 0x01 }, HD_FORMAT_INT },
+	{ HD_TUNE, "tune", { 0x02, 0x01 }, HD_FORMAT_BANDINT },
+	{ HD_SEEK, "seek", { 0x03, 0x01 }, HD_FORMAT_BANDINT },
+	{ HD_HDACTIVE, "hdactive", { 0x01, 0x02 }, HD_FORMAT_BOOLEAN },
+	{ HD_HDSTREAMLOCK, "hdstreamlock", { 0x02, 0x02 }, HD_FORMAT_BOOLEAN },
+	{ HD_HDSIGNALSTRENGTH, "hdsignalstrength", { 0x03, 0x02 }, HD_FORMAT_INT },
+	{ HD_HDSUBCHANNEL, "hdsubchannel", { 0x04, 0x02 }, HD_FORMAT_INT },
+	{ HD_HDSUBCHANNELCOUNT, "hdsubchannelcount", { 0x05, 0x02 }, HD_FORMAT_INT },
+	{ HD_HDENABLEHDTUNER, "hdenablehdtuner", { 0x06, 0x02 }, HD_FORMAT_BOOLEAN },
+	{ HD_HDTITLE, "hdtitle", { 0x07, 0x02 }, HD_FORMAT_INTSTRING },
+	{ HD_HDARTIST, "hdartist", { 0x08, 0x02 }, HD_FORMAT_INTSTRING },
+	{ HD_HDCALLSIGN, "hdcallsign", { 0x09, 0x02 }, HD_FORMAT_STRING },
+	{ HD_HDSTATIONNAME, "hdstationname", { 0x10, 0x02 }, HD_FORMAT_STRING },
+	{ HD_HDUNIQUEID, "hduniqueid", { 0x11, 0x02 }, HD_FORMAT_STRING },
+	{ HD_HDAPIVERSION, "hdapiversion", { 0x12, 0x02 }, HD_FORMAT_STRING },
+	{ HD_HDHWVERSION, "hdhwversion", { 0x13, 0x02 }, HD_FORMAT_STRING },
+	{ HD_RDSENABLE, "rdsenable", { 0x01, 0x03 }, HD_FORMAT_BOOLEAN },
+	{ HD_RDSUNKNOWN1, "rdsunknown1", { 0x02, 0x03 }, HD_FORMAT_NONE },
+	{ HD_RDSUNKNOWN2, "rdsunknown2", { 0x03, 0x03 }, HD_FORMAT_NONE },
+	{ HD_RDSUNKNOWN3, "rdsunknown3", { 0x04, 0x03 }, HD_FORMAT_NONE },
+	{ HD_RDSUNKNOWN4, "rdsunknown4", { 0x05, 0x03 }, HD_FORMAT_NONE },
+	{ HD_RDSUNKNOWN5, "rdsunknown5", { 0x06, 0x03 }, HD_FORMAT_NONE },
+	{ HD_RDSGENRE, "rdsgenre", { 0x07, 0x03 }, HD_FORMAT_STRING },
+	{ HD_RDSPROGRAMSERVICE, "rdsprogramservice", { 0x08, 0x03 }, HD_FORMAT_STRING },
+	{ HD_RDSRADIOTEXT, "rdsradiotext", { 0x09, 0x03 }, HD_FORMAT_STRING },
+	{ HD_UNKNOWN1, "unknown1", { 0x01, 0x04 }, HD_FORMAT_NONE },
+	{ HD_UNKNOWN2, "unknown2", { 0x02, 0x04 }, HD_FORMAT_NONE },
+	{ HD_VOLUME, "volume", { 0x03, 0x04 }, HD_FORMAT_INT },
+	{ HD_BASS, "bass", { 0x04, 0x04 }, HD_FORMAT_INT },
+	{ HD_TREBLE, "treble", { 0x05, 0x04 }, HD_FORMAT_INT },
+	{ HD_COMPRESSION, "compression", { 0x06, 0x04 }, HD_FORMAT_NONE },
+};
+
+constexpr bool hd_tableinorder() {
+	for (int i = 0; i < HD_NUMCOMMANDS; i++)
+		if (hd_commandtable[i].command != i)
+			return false;
+	return true;
+}
+static_assert(hd_tableinorder(), "hd_commandtable must follow HDCommand");
+
+// Command codes have their first byte below 0x20 and their second below 0x08.
+struct HDCodeMap {
+	unsigned char command[0x20][0x08];
+};
+
+constexpr HDCodeMap hd_makecodemap() {
+	HDCodeMap map = {};
+	for (int i = 0; i < 0x20; i++)
+		for (int j = 0; j < 0x08; j++)
+			map.command[i][j] = HD_NUMCOMMANDS;
+	for (int i = 0; i < HD_NUMCOMMANDS; i++)
+		map.command[hd_commandtable[i].code[0]][hd_commandtable[i].code[1]] = i;
+	return map;
+}
+
+constexpr HDCodeMap hd_codemap = hd_makecodemap();
+
+/**
+ * Find the command a reply is for from its code.
+ * @return the command, or HD_NUMCOMMANDS if the code is not one we know
+ */
+constexpr HDCommand hd_commandbycode(unsigned char a, unsigned char b) {
+	return a < 0x20 && b < 0x08 ? (HDCommand)hd_codemap.command[a][b] : HD_NUMCOMMANDS;
+}
+
+constexpr bool hd_samename(const char* a, const char* b) {
+	while (*a != 0 && *a == *b) {
+		a++;
+		b++;
+	}
+	return *a == *b;
+}
+
+/**
+ * Find a command by name.
+ * @param name name of the command, like "volume"
+ * @return the command, or HD_NUMCOMMANDS if there is none by that name
+ */
+constexpr HDCommand hd_findcommand(const char* name) {
+	for (int i = 0; i < HD_NUMCOMMANDS; i++)
+		if (hd_samename(hd_commandtable[i].name, name))
+			return hd_commandtable[i].command;
+	return HD_NUMCOMMANDS;
+}
+
+// Argument values, sent as 4 bytes, little endian.
+constexpr uint32_t HD_ZERO = 0x00000000;
+constexpr uint32_t HD_ONE = 0x00000001;
+constexpr uint32_t HD_UP = 0x00000001;
+constexpr uint32_t HD_DOWN = 0xFFFFFFFF;
+constexpr uint32_t HD_AM = 0x00000000;
+constexpr uint32_t HD_FM = 0x00000001;
+
+struct HDConstantDef {
+	const char* name;
+	uint32_t value;
+};
+
+constexpr HDConstantDef hd_constanttable[] = {
+	{ "up", HD_UP },
+	{ "down", HD_DOWN },
+	{ "one", HD_ONE },
+	{ "zero", HD_ZERO },
+	{ "am", HD_AM },
+	{ "fm", HD_FM },
+};
+
+/**
+ * Find an argument value by name, like "up" or "fm".
+ * @param name the name of the value
+ * @param value set to the value found
+ * @return true if there is a value by that name
+ */
+constexpr bool hd_findconstant(const char* name, uint32_t* value) {
+	for (const HDConstantDef& c : hd_constanttable) {
+		if (hd_samename(c.name, name)) {
+			*value = c.value;
+			return true;
+		}
+	}
+	return false;
+}
+
 class HDVals {
 		 volatile bool keepreading;
-		 map<string,string> hd_cmds;
-		 map<string,string> hd_codes;
-		 map<string,string> hd_format;
-		 map<string,string> hd_ops;
-		 map<string,string> hd_band;
-		 map<string,string> hd_constants;
 		 map<string,string> hd_scale;
 
-		string commands[32][32];
-
 	public:
 		HDVals();
-		string getcmd(unsigned char, unsigned char);
-		string getcode(string);
-		string getcommand(string);
-		string getop(string);
-		string getband(string);
-		string getconstant(string);
-		string getformat(string);
 		bool getscaled(string);
 
 	protected:
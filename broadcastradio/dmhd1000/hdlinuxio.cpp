@@ -19,6 +19,8 @@
 #include <unistd.h>
 #include <termios.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <time.h>
@@ -28,12 +30,16 @@ using namespace std;
 
 #define  LOGD(...)  __android_log_print(ANDROID_LOG_DEBUG,"RADIO",__VA_ARGS__)
 
+// Longest frame on the wire, with every byte after the header escaped.
+#define HDMAXRAWFRAME	(1 + 2 * (1 + 255 + 1))
+
 /**
  * Create the LinuxPort class.  Set all initial variables.
  */
 LinuxPort::LinuxPort() {
 	isOpen = false;
 	portfd = 0; lastread = 0; cflag = 0xA4;
+	rxstart = 0; rxend = 0; rxdiscarded = 0; rxbadsums = 0;
 	testparm[0] = 0xA4; testparm[1] = 0x08;  testparm[2] = 0x01;  testparm[3] = 0x00;
 	testparm[4] = 0x02; testparm[5] = 0x00;  testparm[6] = 0x01;  testparm[7] = 0x00;
 	testparm[8] = 0x00;  testparm[9] = 0x00; testparm[10] = 0xB0;
@@ -161,10 +167,12 @@ void LinuxPort::setportattr(int fd) { //public
 	tty.c_lflag = 0;				// no signaling chars, no echo,
 							// no canonical processing
 	tty.c_oflag = 0;				// no remapping, no delays
-	tty.c_cc[VMIN]  = 0xff;				// read blocks for min 255 bytes
-	tty.c_cc[VTIME] = 5;				// 0.5 seconds read timeout
+	tty.c_cc[VMIN]  = 1;				// hdreadframe() polls, then
+	tty.c_cc[VTIME] = 0;				// takes whatever has arrived
 
 	tty.c_iflag &= ~(IXON | IXOFF | IXANY);		// shut off xon/xoff ctrl
+	tty.c_iflag &= ~(ICRNL | INLCR | IGNCR | ISTRIP);	// frames are binary,
+							// keep CR and NL as sent
 
 	tty.c_cflag |= (CLOCAL | CREAD);		// ignore modem controls,
 							// enable reading
@@ -209,6 +217,7 @@ void LinuxPort::closeport() { //public
 	if (portfd == 0)
 		return;
 	if (verbose) printdtr("About to close ports");
+	LOGD("Serial port closed, %lu bytes discarded, %lu bad checksums", rxdiscarded, rxbadsums);
 	close(portfd);
 	cout << "Serial port closed: " << serialdevice << endl;
 	return;
@@ -255,65 +264,177 @@ void LinuxPort::hdsendbyte(char outbyte) { //public
 /**
  * Send a series of bytes or characters through the serial port to the device.
  * @param outbytes the characters/bytes to send
+ * @param len number of bytes to send
+ * @return true if all of them were written
  */
-void LinuxPort::hdsendbytes(char* outbytes) { //public
-	write(portfd, outbytes, sizeof(outbytes));
-// 	int rc = write(portfd, outbytes, sizeof(outbytes));
-// 	cout << "Send bytes, FD: " << portfd << ", Return code: " << rc << endl;
-	return;
+bool LinuxPort::hdsendbytes(const unsigned char* outbytes, int len) { //public
+	int n;
+	while (len > 0) {
+		n = write(portfd, outbytes, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			LOGD("Can't write to the serial port (%s)", n < 0 ? strerror(errno) : "no progress");
+			return false;
+		}
+		outbytes += n;
+		len -= n;
+	}
+	return true;
 }
 
 /**
- * Read the specified number of bytes from the serial port.  Our buffer is 1k, since
- * we're never working with anywhere near that much data anyway.
- * @param ilen number of bytes to read in
- * @return pointer to the buffer where  returned data is stored.
+ * Get the byte at p[*raw] with its escape removed, moving *raw past it.
+ * @return the byte, or -1 if the rest of it has not been received yet
  */
-unsigned char* LinuxPort::hdreadbytes(int ilen) { //public
-	unsigned char* buff = new unsigned char[1024];
-	int rd = 0;
-
-	int n, i;
-	unsigned char cs;
-	buff[0] = 0;
-	if (ilen > 1024)
-		return buff;
-	if (!isOpen) {
-		LOGD("Having to re-open port");
-		openport();
-	}
-	while (rd < 1) {
-		n = read(portfd, buff, 1);
-		if (n != 1 || buff[0] != 0xa4) continue;
-		n = read(portfd, buff+1, 1);
-		if (n != 1) continue;
-		n = read(portfd, buff+2, buff[1]+1);
-		if (n < buff[1]+1) continue;
-		cs = 0;
-		for (i=0; i<buff[1]+2; i++){
-			cs += buff[i];
+static int unescape(const unsigned char* p, int avail, int* raw) {
+	if (*raw >= avail)
+		return -1;
+	if (p[*raw] != HDESCAPE)
+		return p[(*raw)++];
+	if (*raw + 1 >= avail)
+		return -1;
+	*raw += 2;
+	return p[*raw - 1] == HDESCAPEDHEADER ? HDFRAMEHEADER : p[*raw - 1];
+}
+
+/**
+ * Look for a complete frame in the receive buffer.  Bytes before a header are
+ * dropped, and so is a header whose frame has a bad checksum, so we get back
+ * in step with the radio on the next header.  A frame with escaped bytes is
+ * unescaped in place once its checksum has been verified.
+ * @param frame set to the frame found
+ * @return true if a frame was found, false if more data is needed
+ */
+bool LinuxPort::parseframe(HDFrame* frame) {//protected
+	unsigned char *p, *next, *out, cs;
+	int avail, len, i, c, raw;
+
+	while (rxstart < rxend) {
+		p = rxbuf + rxstart;
+		avail = rxend - rxstart;
+		if (p[0] != HDFRAMEHEADER) {
+			next = (unsigned char*)memchr(p, HDFRAMEHEADER, avail);
+			i = next ? next - p : avail;
+			rxstart += i;
+			rxdiscarded += i;
+			continue;
 		}
-		LOGD("Calculated CS: 0x%02X, read CS: 0x%02X", cs, buff[buff[1]+2]);
-		if (cs != buff[buff[1]+2]) continue;
+		// Escaping only makes a frame longer, so this much is always needed.
+		if (avail < 2 || avail < p[1] + 3)
+			return false;
 
-		rd = 1;
+		// Most frames have nothing escaped, not even their length, and are
+		// checked as they are.
+		len = p[1] + 3;
+		if (memchr(p + 1, HDESCAPE, len - 1) == NULL) {
+			cs = 0;
+			for (i = 0; i < len - 1; i++)
+				cs += p[i];
+			if (cs == p[len - 1]) {
+				frame->data = p;
+				frame->length = len;
+				rxstart += len;
+				return true;
+			}
+		} else {
+			raw = 1;
+			c = unescape(p, avail, &raw);
+			len = c + 3;
+			cs = HDFRAMEHEADER + c;
+			for (i = 2; i < len && c >= 0; i++) {
+				c = unescape(p, avail, &raw);
+				if (i < len - 1)
+					cs += c;
+			}
+			if (c < 0 && avail < HDMAXRAWFRAME)
+				return false;
+			if (c >= 0 && cs == c) {
+				out = p + 1;
+				i = 1;
+				while (out < p + len)
+					*out++ = unescape(p, avail, &i);
+				frame->data = p;
+				frame->length = len;
+				rxstart += raw;
+				return true;
+			}
+		}
+
+		LOGD("Bad checksum on a %d byte frame, looking for the next one", len);
+		rxbadsums++;
+		rxstart++;
+		rxdiscarded++;
 	}
-	lastread = rd;
-	return buff;
+	return false;
 }
 
 /**
- * Read a single byte into a buffer and return it.
- * @return pointer to a 1 byte buffer with one byte read from the port
+ * Read the next frame from the radio.  The port is read in bulk into our receive
+ * buffer, and frames are handed out from there without copying them.  A partial
+ * frame that is still incomplete when the timeout expires is dropped.
+ * @param frame set to the frame read, valid until the next call
+ * @param timeout how long to wait for a frame, in milliseconds
+ * @return true if a frame was read, false if there was none before the timeout
  */
-char* LinuxPort::hdreadbyte() { //public
-	char* buff = (char*)hdreadbytes(1);
-	return buff;
+bool LinuxPort::hdreadframe(HDFrame* frame, int timeout) { //public
+	struct pollfd pfd;
+	int n;
+
+	if (!isOpen) {
+		LOGD("Having to re-open port");
+		openport();
+	}
+	while (!parseframe(frame)) {
+		// Keep room for the longest frame after what is left over.
+		if (rxstart == rxend) {
+			rxstart = rxend = 0;
+		} else if (rxend > (int)sizeof(rxbuf) - HDMAXRAWFRAME) {
+			memmove(rxbuf, rxbuf + rxstart, rxend - rxstart);
+			rxend -= rxstart;
+			rxstart = 0;
+		}
+
+		pfd.fd = portfd;
+		pfd.events = POLLIN;
+		n = poll(&pfd, 1, timeout);
+		if (n == 0) {
+			// Nothing more came in, so what is left can't complete: its header
+			// was a stray byte, and a frame may be waiting behind it.
+			while (rxstart < rxend) {
+				rxstart++;
+				rxdiscarded++;
+				if (parseframe(frame)) {
+					lastread = frame->length;
+					return true;
+				}
+			}
+			return false;
+		}
+		if (n < 0 || (pfd.revents & (POLLERR | POLLNVAL))) {
+			if (n < 0 && errno == EINTR)
+				continue;
+			LOGD("Can't poll the serial port (%s)", n < 0 ? strerror(errno) : "error");
+			usleep(timeout * 1000);
+			return false;
+		}
+		n = read(portfd, rxbuf + rxend, sizeof(rxbuf) - rxend);
+		if (n < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+		if (n <= 0) {
+			LOGD("Can't read the serial port (%s)", n < 0 ? strerror(errno) : "hang up");
+			usleep(timeout * 1000);
+			return false;
+		}
+		rxend += n;
+	}
+	lastread = frame->length;
+	return true;
 }
 
 /**
- * Number of bytes read in on the last read.
- * @return number of bytes read in
+ * Length of the last frame read.
+ * @return number of bytes in the frame
  */
 int LinuxPort::hdlastreadleangth() { //public
 	return lastread;
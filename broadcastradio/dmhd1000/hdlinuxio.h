@@ -14,6 +14,22 @@
 
 using namespace std;
 
+// Frame header, and the escape byte sent before a 0x1B or 0xA4 (as 0x48) in
+// the rest of a frame.
+#define HDFRAMEHEADER	0xA4
+#define HDESCAPE	0x1B
+#define HDESCAPEDHEADER	0x48
+
+/**
+ * A frame from the radio: the 0xA4 header, the length, the body and the
+ * checksum.  It points into the receive buffer of the port and is only valid
+ * until the next call to hdreadframe().
+ */
+struct HDFrame {
+	const unsigned char* data;
+	int length;
+};
+
 class LinuxPort {
 		 bool isOpen, verbose;
 		 int portfd, lastread, cflag;
@@ -28,6 +44,11 @@ class LinuxPort {
 		 string serialdevice;
 		 string testdata;
 		 struct termios options/*, oldios*/;
+		 // Bytes from the radio not yet handed out as frames are
+		 // rxbuf[rxstart] to rxbuf[rxend - 1].
+		 unsigned char rxbuf[4096];
+		 int rxstart, rxend;
+		 unsigned long rxdiscarded, rxbadsums;
 
 	public:
 		LinuxPort();
@@ -39,9 +60,8 @@ class LinuxPort {
 		void setserialport(string);
 		string getserialport();
 		void hdsendbyte(char);
-		void hdsendbytes(char*);
-		unsigned char* hdreadbytes(int);
-		char* hdreadbyte();
+		bool hdsendbytes(const unsigned char*, int);
+		bool hdreadframe(HDFrame*, int);
 		int hdlastreadleangth();
 		void toggledtr(bool);
 		void printdtr();
@@ -51,6 +71,7 @@ class LinuxPort {
 
 	protected:
 		void chout(unsigned char);
+		bool parseframe(HDFrame*);
 
 	private:
 
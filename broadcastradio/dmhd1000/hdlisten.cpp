@@ -30,6 +30,7 @@ using namespace std;
  * for "hdtitle" and "hdartist" will alwyas reflect the info for the current subchannel.
  */
 HDListen::HDListen() {//public
+	int i;
 	verbose = false;
 	keepReading = true; havecode = false; valueset = false; escChar = false; lengthWait = false;
 	msglen = -1; msgin = -1;
@@ -44,9 +45,24 @@ HDListen::HDListen() {//public
 	hdvals = 0;
 	bq = (int *)malloc(sizeof(int)*1024);
 	radiovals["initialized"] = "true";
+	nocb = true;
+	for (i = 0; i < HD_NUMCOMMANDS; i++)
+		handlers[i] = NULL;
+	for (i = 0; dispatchtable[i].handler != NULL; i++)
+		handlers[dispatchtable[i].command] = dispatchtable[i].handler;
 	return;
 }
 
+const HDListen::HDDispatch HDListen::dispatchtable[] = {
+	{ HD_TUNE, &HDListen::ontune },
+	{ HD_SEEK, &HDListen::onseek },
+	{ HD_RDSPROGRAMSERVICE, &HDListen::onrdstext },
+	{ HD_RDSRADIOTEXT, &HDListen::onrdstext },
+	{ HD_RDSGENRE, &HDListen::onrdstext },
+	{ HD_SIGNALSTRENGTH, &HDListen::onsignalstrength },
+	{ HD_NUMCOMMANDS, NULL },
+};
+
 /**
  * Set the verbosity of this class to true if debugging statements are desired.
  * @param verbosity true for debugging output to the console
@@ -192,43 +208,58 @@ map<int,string> HDListen::gethdartists() {//public
 }
 
 /**
- * Process a complete message we've received from the radio.  See what kind of format it is in,
- * what the message name is, and what the data is.  Store the result as the proper key/value pair
- * in the map of values.
+ * Process a complete message we've received from the radio.  The code gives the
+ * message name and its format, from which we decode the value.  Only messages we
+ * pass on to the tuner callback are decoded, the others are dropped right away.
+ * Nothing is allocated here: strings are left in the frame until the handler
+ * copies them into its own buffers.
+ * @param frame the frame from the radio
+ * @return true if the message was passed on
  */
-string HDListen::decodemsg(unsigned char *message) {//protected
-	int ival;
-	string msgname, msgfmt, msgval = "", val1, val2, valx;
-	uint32_t len = 0;
-	uint32_t i;
+bool HDListen::decodemsg(const HDFrame& frame) {//protected
+	const unsigned char *message = frame.data;
+	HDMessage msg;
+	uint32_t len;
+	char mesbuf[3 * 258 + 1], *out = mesbuf;
+	int i;
+
+	// Too short to hold a message code.
+	if (frame.length < 5)
+		return false;
+	msg.command = hd_commandbycode(message[2], message[3]);
+	if (msg.command == HD_NUMCOMMANDS || handlers[msg.command] == NULL) {
+		LOGD("Skipping message %02X %02X", message[2], message[3]);
+		return false;
+	}
 
-	char mesbuf[4096];
 	mesbuf[0] = 0;
-
-	for (i=0; i<message[1]+3; i++){
-		sprintf(mesbuf+strlen(mesbuf), "%02X ", message[i]);
-	}
+	for (i = 0; i < frame.length; i++)
+		out += sprintf(out, "%02X ", message[i]);
 	LOGD("Received BUFFER: %s", mesbuf);
 
-	msgname = hdvals->getcmd(message[2], message[3]);
-	msgfmt = hdvals->getformat(msgname);
-	if (msgfmt == "boolean") {
-		if (msgval == hdvals->getconstant("one"))
-			msgval = "true";
-		else
-			msgval = "false";
-	} else if (msgfmt == "int") {
-		// A4 08 01 01 02 00 2C 01 00 00
+	msg.value = 0;
+	msg.fm = false;
+	msg.text = NULL;
+	msg.textlen = 0;
+	// Every value comes after the 6 bytes of header, length, code and operation,
+	// and before the checksum.
+	switch (hd_commandtable[msg.command].format) {
+	case HD_FORMAT_BOOLEAN:
+		if (frame.length < 11) return false;
+		msg.value = message[6] != 0;
+		break;
+	case HD_FORMAT_INT:
+		// A4 08 01 01 02 00 2C 01 00 00 xx
 		// A4: start of message
 		// 08: length
 		// 01 01: signal strength
 		// 02 00: reply
 		// 2C 01: value (little endian)
 		// 00 00: ???
-		ival = ((int)message[6] + (((int)message[7])<<8));
-		sprintf(curmsg, "%d", ival);
-		msgval = curmsg;
-	} else if (msgfmt == "string") {
+		if (frame.length < 11) return false;
+		msg.value = (int)message[6] + (((int)message[7])<<8);
+		break;
+	case HD_FORMAT_STRING:
 		// A4: header
 		// 10: packet length
 		// 08 03: RDS PS
@@ -236,10 +267,15 @@ string HDListen::decodemsg(unsigned char *message) {//protected
 		// 08 00 00 00: string length
 		// 20 20 38 38 2E 35 20 20 "  88.5  "
 		// 1C: checksum
-
+		if (frame.length < 11) return false;
 		len = ((uint32_t)message[6]) + (((uint32_t)message[7])<<8) + (((uint32_t)message[8])<<16) + (((uint32_t)message[9])<<24);
-		for (i=10; i<len+10; i++) msgval += message[i];
-	} else if (msgfmt == "band:int") {
+		// The frame only holds what is before the checksum.
+		if (len > (uint32_t)frame.length - 11)
+			len = frame.length - 11;
+		msg.text = (const char*)message + 10;
+		msg.textlen = len;
+		break;
+	case HD_FORMAT_BANDINT:
 		// Received BUFFER: A4 14 03 01 02 00 01 00 00 00 CF 03 00 00 00 00 00 00 00 00 00 00 91
 		// A4: header
 		// 14: length
@@ -247,43 +283,19 @@ string HDListen::decodemsg(unsigned char *message) {//protected
 		// 02 00: response
 		// 01 00 00 00: FM (00 00 00 00 = AM)
 		// CF 03 ....: freq little-endian 0x03cf = 975 = 97.5 MHz
-
-		if (message[6] == 0x01){ // FM
-			sprintf(curmsg, "%d FM", (int)message[10] + ((int)message[11]<<8));
-		} else { // AM
-			sprintf(curmsg, "%d AM", (int)message[10] + ((int)message[11]<<8));
-		}
-		msgval = curmsg;
-
-	/* Lets just disable HD radio altogether. It can only cause annoyance.
-	} else if (msgfmt == "int:string") {
-		if (currentsubchannel < 1) {
-			cout << "Setting subchannel to 1\n";
-			currentsubchannel = 1;
-			sethdval("hdsubchannel", "1");
-		}
-		val1 = msgval.substr(0, 19);
-		val2 = msgval.substr(40, msgval.size());
-		ival = hexbytestoint(val1);
-		msgval = hexbytestostring(val2);
-		sprintf(xfer, "%d", ival);
-		val1 = xfer;
-		if (msgname == "hdtitle")
-			sethdtitle(ival, msgval);
-		if (msgname == "hdartist")
-			sethdartist(ival, msgval);
-		if (verbose) cout << "Message name(a): " << msgname << ":" << val1 << ", Value: \"" << msgval << "\"" << endl;
-		if (currentsubchannel != ival) {
-			return msgval;
-		}
-	*/
-	} else if (msgfmt == "none" || msgfmt == "int:string") {
-		msgval = "";
+		if (frame.length < 15) return false;
+		msg.fm = message[6] == 0x01;
+		msg.value = (int)message[10] + ((int)message[11]<<8);
+		break;
+	default:
+		// HD subchannel info is disabled altogether.  It can only cause annoyance.
+		break;
 	}
-	LOGD("Message name: %s, Value: %s",msgname.c_str(),msgval.c_str());
+	LOGD("Message name: %s, Value: %d, Text: %.*s", hd_commandtable[msg.command].name,
+		msg.value, msg.textlen, msg.text ? msg.text : "");
 
-	callback(msgname,msgval);
-	return msgval;
+	callback(msg);
+	return true;
 }
 
 void HDListen::passCB(
@@ -294,12 +306,14 @@ void HDListen::passCB(
 	ps = in_ps;
 	pi = in_pi;
 	cb = in_cb;
+	// Casting asks the other side for its interfaces, so only do it once.
+	cb11 = android::hardware::broadcastradio::V1_1::ITunerCallback::castFrom(cb).withDefault(nullptr);
 	nocb = false;
 }
 
-void HDListen::callback(string name, string val){
-
-/*
+/**
+ * Pass a message on to the tuner callback, through the handler for its name.
+ *
  * I've seen these;
  *
  * volume (0-100)
@@ -313,109 +327,121 @@ void HDListen::callback(string name, string val){
  * seek (freq BAND)
  * tune (freq BAND)
  */
-
-	LOGD("CALLBACK: %s / %s", name.c_str(), val.c_str());
-	bool fm = false;
-	bool rds = false;
-	int freq = 0;
+void HDListen::callback(const HDMessage& msg){
 	char prop[PROP_VALUE_MAX];
-	android::sp<android::hardware::broadcastradio::V1_1::ITunerCallback> mCB = nullptr;
+
 	property_get("service.broadcastradio.on", prop, "0");
-	LOGD("Read property service.broadcastradio.on = %s", prop);
-	
-	if (prop[0] == '1' && nocb != true){
-		mCB = android::hardware::broadcastradio::V1_1::ITunerCallback::castFrom(cb).withDefault(nullptr);
-		if (strcmp(name.c_str(), "seek") == 0){
-			fm = (strstr(val.c_str(), "FM") != NULL);
-			freq = (int)(atof(val.c_str()) * (fm?100:1));
-			if (fm && (freq < 85000 || freq > 109000)) return;
-			if (!fm && (freq < 500 || freq > 1800)) return;
-			pi.base.channel = freq;
-			ps.primaryId.type = 1;
-			ps.primaryId.value = freq;
-			pi.selector = ps;
-			pi.base.tuned = 0;
-			pi.base.stereo = 1;
-			pi.base.digital = 0;
-			pi.base.signalStrength = 50;
-			mCB->currentProgramInfoChanged(pi);
-		} else if (strcmp(name.c_str(), "tune") == 0){
-			rds_ps = "";
-			rds_rt = "";
-			rds_genre = "";
-			fm = (strstr(val.c_str(), "FM") != NULL);
-			freq = (int)(atof(val.c_str()) * (fm?100:1));
-			if (fm && (freq < 85000 || freq > 109000)) return;
-			if (!fm && (freq < 500 || freq > 1800)) return;
-			pi.base.channel = freq;
-			ps.primaryId.type = 1;
-			ps.primaryId.value = freq;
-			pi.selector = ps;
-			pi.base.tuned = 1;
-			pi.base.stereo = 1;
-			pi.base.digital = 0;
-			pi.base.signalStrength = 50;
-			mCB->tuneComplete_1_1(android::hardware::broadcastradio::V1_0::Result::OK, pi.selector);
-			rds = true;
-		} else if (strcmp(name.c_str(), "rdsprogramservice") == 0){
-			rds_ps = val;
-			rds = true;
-		} else if (strcmp(name.c_str(), "rdsradiotext") == 0){
-			rds_rt = val;
-			rds = true;
-		} else if (strcmp(name.c_str(), "rdsgenre") == 0){
-			rds_genre = val;
-			rds = true;
-		} else if (strcmp(name.c_str(), "signalstrength") == 0){
-			pi.base.signalStrength = atoi(val.c_str());
-			if (pi.base.signalStrength < 400) pi.base.signalStrength = 0;
-			else if (pi.base.signalStrength > 2850) pi.base.signalStrength = 100;
-			else pi.base.signalStrength = (int)(((float) (pi.base.signalStrength - 400) / (float) 2450) * 100);
-			mCB->currentProgramInfoChanged(pi);
-		}
-		if (rds) {
-			pi.base.metadata = android::hardware::hidl_vec<android::hardware::broadcastradio::V1_0::MetaData>(3);
-			pi.base.metadata[0] = {
-				android::hardware::broadcastradio::V1_0::MetadataType::TEXT,
-				android::hardware::broadcastradio::V1_0::MetadataKey::RDS_PS,
-				{},
-				{},
-				rds_ps,
-				{}
-			};
-			pi.base.metadata[1] = {
-				android::hardware::broadcastradio::V1_0::MetadataType::TEXT,
-				android::hardware::broadcastradio::V1_0::MetadataKey::TITLE,//RDS_RT,
-				{},
-				{},
-				rds_rt,
-				{}
-			};
-			pi.base.metadata[2] = {
-				android::hardware::broadcastradio::V1_0::MetadataType::TEXT,
-				android::hardware::broadcastradio::V1_0::MetadataKey::GENRE,
-				{},
-				{},
-				rds_genre,
-				{}
-			};
-			mCB->currentProgramInfoChanged(pi);
-		}
-	} else nocb = true;
-
-	if (cb == nullptr){
+	if (prop[0] != '1' || nocb == true) {
+		nocb = true;
+		return;
+	}
+	if (cb11 == nullptr){
 		LOGD("CB is nullptr");
+		return;
+	}
+	(this->*handlers[msg.command])(msg);
+}
+
+/**
+ * Point the program info at the frequency in a tune or seek reply.
+ * @param msg the reply
+ * @param tuned true if the tuner has settled on the frequency
+ * @return false if the frequency is outside its band
+ */
+bool HDListen::setchannel(const HDMessage& msg, bool tuned){
+	int freq = msg.value * (msg.fm ? 100 : 1);
+	if (msg.fm && (freq < 85000 || freq > 109000)) return false;
+	if (!msg.fm && (freq < 500 || freq > 1800)) return false;
+	pi.base.channel = freq;
+	ps.primaryId.type = 1;
+	ps.primaryId.value = freq;
+	pi.selector = ps;
+	pi.base.tuned = tuned;
+	pi.base.stereo = 1;
+	pi.base.digital = 0;
+	pi.base.signalStrength = 50;
+	return true;
+}
+
+/**
+ * Put the RDS strings in the program info and send it.  The metadata entries are
+ * only created the first time.
+ */
+void HDListen::updatemetadata(){
+	if (pi.base.metadata.size() != 3) {
+		pi.base.metadata = android::hardware::hidl_vec<android::hardware::broadcastradio::V1_0::MetaData>(3);
+		pi.base.metadata[0] = {
+			android::hardware::broadcastradio::V1_0::MetadataType::TEXT,
+			android::hardware::broadcastradio::V1_0::MetadataKey::RDS_PS,
+			{},
+			{},
+			{},
+			{}
+		};
+		pi.base.metadata[1] = {
+			android::hardware::broadcastradio::V1_0::MetadataType::TEXT,
+			android::hardware::broadcastradio::V1_0::MetadataKey::TITLE,//RDS_RT,
+			{},
+			{},
+			{},
+			{}
+		};
+		pi.base.metadata[2] = {
+			android::hardware::broadcastradio::V1_0::MetadataType::TEXT,
+			android::hardware::broadcastradio::V1_0::MetadataKey::GENRE,
+			{},
+			{},
+			{},
+			{}
+		};
 	}
+	pi.base.metadata[0].stringValue = rds_ps;
+	pi.base.metadata[1].stringValue = rds_rt;
+	pi.base.metadata[2].stringValue = rds_genre;
+	cb11->currentProgramInfoChanged(pi);
+}
+
+void HDListen::ontune(const HDMessage& msg){
+	rds_ps.clear();
+	rds_rt.clear();
+	rds_genre.clear();
+	if (!setchannel(msg, true)) return;
+	cb11->tuneComplete_1_1(android::hardware::broadcastradio::V1_0::Result::OK, pi.selector);
+	updatemetadata();
+}
+
+void HDListen::onseek(const HDMessage& msg){
+	if (!setchannel(msg, false)) return;
+	cb11->currentProgramInfoChanged(pi);
+}
+
+void HDListen::onrdstext(const HDMessage& msg){
+	// assign() reuses the capacity the strings already have.
+	if (msg.command == HD_RDSPROGRAMSERVICE)
+		rds_ps.assign(msg.text, msg.textlen);
+	else if (msg.command == HD_RDSRADIOTEXT)
+		rds_rt.assign(msg.text, msg.textlen);
+	else
+		rds_genre.assign(msg.text, msg.textlen);
+	updatemetadata();
+}
+
+void HDListen::onsignalstrength(const HDMessage& msg){
+	pi.base.signalStrength = msg.value;
+	if (pi.base.signalStrength < 400) pi.base.signalStrength = 0;
+	else if (pi.base.signalStrength > 2850) pi.base.signalStrength = 100;
+	else pi.base.signalStrength = (int)(((float) (pi.base.signalStrength - 400) / (float) 2450) * 100);
+	cb11->currentProgramInfoChanged(pi);
 }
 
 /**
  * Read input from the serial port
  */
 void HDListen::readinfile() {//protected
-	unsigned char *buff;
+	HDFrame frame;
 	while (keepReading) {
-		buff = ioport->hdreadbytes(1);
-		if (buff != NULL) decodemsg(buff);
+		// Wake up now and then to see if we have been told to stop.
+		if (ioport->hdreadframe(&frame, 500)) decodemsg(frame);
 	}
 	return;
 }
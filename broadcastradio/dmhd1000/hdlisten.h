@@ -12,6 +12,17 @@
 
 using namespace std;
 
+/**
+ * A reply from the radio, decoded.  The text points into the frame it came from.
+ */
+struct HDMessage {
+	HDCommand command;
+	int value;		// boolean, int and frequency values
+	bool fm;		// band of a frequency
+	const char* text;	// string values, not terminated
+	int textlen;
+};
+
 class HDListen {
 		 bool verbose;
 		 bool keepReading, havecode, valueset, escChar, lengthWait;
@@ -35,6 +46,8 @@ class HDListen {
 		android::hardware::broadcastradio::V1_1::ProgramSelector ps;
 		android::hardware::broadcastradio::V1_1::ProgramInfo pi;
 		android::sp<android::hardware::broadcastradio::V1_0::ITunerCallback> cb;
+		// cb as a 1.1 callback, cast once when it is passed in.
+		android::sp<android::hardware::broadcastradio::V1_1::ITunerCallback> cb11;
 
 		string rds_ps;
 		string rds_rt;
@@ -67,13 +80,28 @@ class HDListen {
 	protected:
 		void sethdval(string, string);
 		void chout(unsigned char);
-		string decodemsg(unsigned char*);
+		bool decodemsg(const HDFrame&);
 		void readinfile();
 
 	private:
+		typedef void (HDListen::*HDHandler)(const HDMessage&);
+		struct HDDispatch {
+			HDCommand command;
+			HDHandler handler;
+		};
+		// Replies we pass on to the tuner callback, and their handlers.
+		static const HDDispatch dispatchtable[];
+		HDHandler handlers[HD_NUMCOMMANDS];
+
 		void sethdtitle(int, string);
 		void sethdartist(int, string);
-		void callback(string,string);
+		void callback(const HDMessage&);
+		bool setchannel(const HDMessage&, bool);
+		void updatemetadata();
+		void ontune(const HDMessage&);
+		void onseek(const HDMessage&);
+		void onrdstext(const HDMessage&);
+		void onsignalstrength(const HDMessage&);
 
 };
 
@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measure HiFi DSP IPC round trips through /dev/hifi_misc.
+ *
+ * For every buffer size the selected request is issued a number of times and
+ * the latency distribution (p50/p99/max and a log2 histogram) and throughput
+ * are reported, together with how many round trips exceeded the budget
+ * (one 5 ms fast mixer period by default).
+ */
+
+#define LOG_TAG "bench-hifi"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <cutils/log.h>
+#include <linux/audio_hifi.h>
+
+#define DEFAULT_ITERATIONS 1000
+#define DEFAULT_BUDGET_US 5000
+#define MAX_SIZES 16
+#define HISTOGRAM_BUCKETS 12    /* < 32us, < 64us, ... < 32ms, >= 32ms */
+#define HISTOGRAM_FIRST_US 32
+
+enum bench_test {
+    TEST_PCM_GAIN,
+    TEST_SYNCMSG,
+    TEST_XAF_IPC,
+};
+
+struct bench_config {
+    enum bench_test test;
+    unsigned int iterations;
+    unsigned int budget_us;
+    unsigned int sizes[MAX_SIZES];
+    unsigned int size_count;
+    uint16_t msg_id;            /* SYNCMSG message id */
+    uint32_t xaf_id;
+    uint32_t xaf_opcode;
+};
+
+/* Part of the HiFi shared memory mapped through /dev/hifi_misc. XAF proxy
+ * messages carry DSP side addresses, so their payloads must live there.
+ */
+struct dsp_shmem {
+    uint8_t *base;
+    size_t size;
+    uint64_t dsp_addr;
+};
+
+static const char *test_names[] = {
+    [TEST_PCM_GAIN] = "pcm_gain",
+    [TEST_SYNCMSG] = "syncmsg",
+    [TEST_XAF_IPC] = "xaf_ipc",
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-t pcm_gain|syncmsg|xaf_ipc] [-n iterations] "
+            "[-s size[,size...]] [-b budget_us] [-m msg_id] [-d xaf_id] [-o xaf_opcode]\n", name);
+    fprintf(stderr, "  -t  request to measure (default pcm_gain)\n");
+    fprintf(stderr, "  -n  round trips per buffer size (default %d)\n", DEFAULT_ITERATIONS);
+    fprintf(stderr, "  -s  comma separated buffer sizes in bytes, at least 2 for syncmsg\n");
+    fprintf(stderr, "  -b  latency budget (default %d us)\n", DEFAULT_BUDGET_US);
+    fprintf(stderr, "  -m  message id placed at the start of SYNCMSG payloads\n");
+    fprintf(stderr, "  -d  XAF proxy message id\n");
+    fprintf(stderr, "  -o  XAF proxy message opcode\n");
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return x < y ? -1 : (x > y);
+}
+
+static int parse_sizes(struct bench_config *config, char *list)
+{
+    char *token, *save;
+
+    config->size_count = 0;
+    for (token = strtok_r(list, ",", &save); token != NULL;
+            token = strtok_r(NULL, ",", &save)) {
+        if (config->size_count == MAX_SIZES)
+            return -1;
+        config->sizes[config->size_count] = strtoul(token, NULL, 0);
+        if (config->sizes[config->size_count] == 0)
+            return -1;
+        config->size_count++;
+    }
+    return config->size_count > 0 ? 0 : -1;
+}
+
+/* One round trip. Returns 0 on success */
+static int round_trip(int fd, const struct bench_config *config,
+                      const struct dsp_shmem *shmem, uint8_t *in, uint8_t *out,
+                      unsigned int size)
+{
+    switch (config->test) {
+    case TEST_PCM_GAIN: {
+        struct misc_io_pcm_buf_param pcmbuf;
+
+        pcmbuf.buf = (uint64_t)in;
+        pcmbuf.buf_size = size;
+        return ioctl(fd, HIFI_MISC_IOCTL_PCM_GAIN, &pcmbuf);
+    }
+    case TEST_SYNCMSG: {
+        struct misc_io_sync_param sync;
+
+        memset(&sync, 0, sizeof(sync));
+        memcpy(in, &config->msg_id, sizeof(config->msg_id));
+        sync.para_in_l = (uint32_t)(uintptr_t)in;
+        sync.para_in_h = (uint32_t)((uint64_t)(uintptr_t)in >> 32);
+        sync.para_size_in = size;
+        sync.para_out_l = (uint32_t)(uintptr_t)out;
+        sync.para_out_h = (uint32_t)((uint64_t)(uintptr_t)out >> 32);
+        sync.para_size_out = size;
+        return ioctl(fd, HIFI_MISC_IOCTL_SYNCMSG, &sync);
+    }
+    case TEST_XAF_IPC: {
+        xf_proxy_msg_t msg;
+        int ret;
+
+        msg.id = config->xaf_id;
+        msg.opcode = config->xaf_opcode;
+        msg.length = size;
+        msg.address = shmem->dsp_addr + (in - shmem->base);
+        msg.v_address = (uint64_t)(uintptr_t)in;
+        ret = ioctl(fd, HIFI_MISC_IOCTL_XAF_IPC_MSG_SEND, &msg);
+        if (ret)
+            return ret;
+        return ioctl(fd, HIFI_MISC_IOCTL_XAF_IPC_MSG_RECV, &msg);
+    }
+    }
+    return -EINVAL;
+}
+
+static void report(const struct bench_config *config, unsigned int size,
+                   int64_t *samples, unsigned int count, unsigned int errors)
+{
+    unsigned int histogram[HISTOGRAM_BUCKETS] = { 0 };
+    unsigned int over_budget = 0;
+    int64_t total = 0;
+    unsigned int i, bucket;
+    int64_t limit_us;
+
+    if (count == 0) {
+        printf("%s size %u: all %u round trips failed\n", test_names[config->test], size, errors);
+        return;
+    }
+
+    qsort(samples, count, sizeof(samples[0]), compare_int64);
+    for (i = 0; i < count; i++) {
+        int64_t us = samples[i] / 1000;
+
+        total += samples[i];
+        if (us >= config->budget_us)
+            over_budget++;
+        for (bucket = 0, limit_us = HISTOGRAM_FIRST_US;
+                bucket < HISTOGRAM_BUCKETS - 1 && us >= limit_us; bucket++)
+            limit_us *= 2;
+        histogram[bucket]++;
+    }
+
+    printf("%s size %u: n=%u errors=%u p50=%lld us p99=%lld us max=%lld us mean=%lld us\n",
+            test_names[config->test], size, count, errors,
+            (long long)(samples[(count - 1) * 50 / 100] / 1000),
+            (long long)(samples[(count - 1) * 99 / 100] / 1000),
+            (long long)(samples[count - 1] / 1000),
+            (long long)(total / count / 1000));
+    printf("    throughput %.2f MB/s, %.0f round trips/s, over %u us budget: %u (%.2f%%)\n",
+            (double)size * count * 1000.0 / total,
+            (double)count * 1000000000.0 / total,
+            config->budget_us, over_budget, 100.0 * over_budget / count);
+    for (bucket = 0, limit_us = HISTOGRAM_FIRST_US; bucket < HISTOGRAM_BUCKETS;
+            bucket++, limit_us *= 2) {
+        if (histogram[bucket] == 0)
+            continue;
+        if (bucket == HISTOGRAM_BUCKETS - 1)
+            printf("    >= %6lld us: %u\n", (long long)(limit_us / 2), histogram[bucket]);
+        else
+            printf("    <  %6lld us: %u\n", (long long)limit_us, histogram[bucket]);
+    }
+}
+
+/* Maps size bytes of the HiFi shared memory and looks up their DSP side address */
+static int map_shmem(int fd, size_t size, struct dsp_shmem *shmem)
+{
+    struct misc_io_get_phys_param phys;
+    long page = sysconf(_SC_PAGESIZE);
+
+    memset(&phys, 0, sizeof(phys));
+    if (ioctl(fd, HIFI_MISC_IOCTL_GET_PHYS, &phys) < 0) {
+        fprintf(stderr, "cannot get the HiFi shared memory address: %s\n", strerror(errno));
+        return -1;
+    }
+    shmem->size = (size + page - 1) / page * page;
+    shmem->base = mmap(NULL, shmem->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shmem->base == MAP_FAILED) {
+        fprintf(stderr, "cannot map %zu bytes of HiFi shared memory: %s\n", shmem->size,
+                strerror(errno));
+        return -1;
+    }
+    shmem->dsp_addr = ((uint64_t)phys.phys_addr_h << 32) | phys.phys_addr_l;
+    return 0;
+}
+
+/* Returns -1 if a buffer size had no successful round trip */
+static int run(int fd, const struct bench_config *config)
+{
+    struct dsp_shmem shmem = { NULL, 0, 0 };
+    unsigned int max_size = 0;
+    unsigned int i, s, count, errors;
+    int64_t *samples;
+    uint8_t *in, *out;
+    int64_t start;
+    int ret = 0;
+
+    for (s = 0; s < config->size_count; s++)
+        if (config->sizes[s] > max_size)
+            max_size = config->sizes[s];
+
+    if (config->test == TEST_XAF_IPC && map_shmem(fd, max_size, &shmem))
+        return -1;
+
+    samples = malloc(sizeof(samples[0]) * config->iterations);
+    in = shmem.base ? shmem.base : malloc(max_size);
+    out = malloc(max_size);
+    if (!samples || !in || !out) {
+        ALOGE("Error allocating buffers");
+        free(samples);
+        if (!shmem.base)
+            free(in);
+        free(out);
+        if (shmem.base)
+            munmap(shmem.base, shmem.size);
+        return -1;
+    }
+
+    for (s = 0; s < config->size_count; s++) {
+        /* Deterministic, non silent PCM-like payload */
+        for (i = 0; i < config->sizes[s]; i++)
+            in[i] = (uint8_t)(i * 7);
+
+        count = 0;
+        errors = 0;
+        for (i = 0; i < config->iterations; i++) {
+            start = now_ns();
+            if (round_trip(fd, config, &shmem, in, out, config->sizes[s]) < 0) {
+                errors++;
+                continue;
+            }
+            samples[count++] = now_ns() - start;
+        }
+        if (errors)
+            ALOGW("%u/%u %s round trips failed, last error %d", errors,
+                    config->iterations, test_names[config->test], errno);
+        report(config, config->sizes[s], samples, count, errors);
+        if (count == 0)
+            ret = -1;
+    }
+
+    free(samples);
+    free(out);
+    if (shmem.base)
+        munmap(shmem.base, shmem.size);
+    else
+        free(in);
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    struct bench_config config = {
+        .test = TEST_PCM_GAIN,
+        .iterations = DEFAULT_ITERATIONS,
+        .budget_us = DEFAULT_BUDGET_US,
+        /* 5 ms, 10 ms, 20 ms and 40 ms of 48 kHz stereo 16-bit audio */
+        .sizes = { 960, 1920, 3840, 7680 },
+        .size_count = 4,
+    };
+    int hifi_dsp_fd;
+    int opt;
+    int ret;
+    unsigned int t;
+
+    while ((opt = getopt(argc, argv, "t:n:s:b:m:d:o:h")) != -1) {
+        switch (opt) {
+        case 't':
+            for (t = 0; t < sizeof(test_names) / sizeof(test_names[0]); t++)
+                if (strcmp(optarg, test_names[t]) == 0)
+                    break;
+            if (t == sizeof(test_names) / sizeof(test_names[0])) {
+                usage(argv[0]);
+                return -1;
+            }
+            config.test = t;
+            break;
+        case 'n':
+            config.iterations = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            if (parse_sizes(&config, optarg)) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'b':
+            config.budget_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            config.msg_id = strtoul(optarg, NULL, 0);
+            break;
+        case 'd':
+            config.xaf_id = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            config.xaf_opcode = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    if (config.iterations == 0) {
+        usage(argv[0]);
+        return -1;
+    }
+    /* SYNCMSG payloads start with the message id */
+    if (config.test == TEST_SYNCMSG) {
+        for (t = 0; t < config.size_count; t++) {
+            if (config.sizes[t] < sizeof(config.msg_id)) {
+                usage(argv[0]);
+                return -1;
+            }
+        }
+    }
+
+    hifi_dsp_fd = open(HIFI_DSP_MISC_DRIVER, O_RDWR, 0);
+    if (hifi_dsp_fd < 0) {
+        ALOGE("Error %d opening hifi dsp device", errno);
+        fprintf(stderr, "cannot open %s: %s\n", HIFI_DSP_MISC_DRIVER, strerror(errno));
+        return -1;
+    }
+
+    ret = run(hifi_dsp_fd, &config);
+
+    close(hifi_dsp_fd);
+    return ret;
+}
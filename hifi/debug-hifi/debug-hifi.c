@@ -20,28 +20,180 @@
 #include <unistd.h>
 #include <poll.h>
 #include <pthread.h>
+#include <signal.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/prctl.h>
 #include <stdio.h>
+#include <time.h>
 #include <cutils/log.h>
 #include <cutils/uevent.h>
 #include <stdlib.h>
 #include <linux/audio_hifi.h>
 
+#define FOLLOW_INTERVAL_MS 200
+/* bytes of the printed log remembered to find where new messages start */
+#define FOLLOW_TAIL_SIZE 256
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+    stop = 1;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-f] [-i interval_ms] [memsize] [clear]\n", name);
+    fprintf(stderr, "  -f  follow: poll the DSP log and print new lines with timestamps\n");
+    fprintf(stderr, "  -i  poll interval in follow mode (default %d ms)\n", FOLLOW_INTERVAL_MS);
+}
+
+/* Print buffer[0..len) prefixing every line with a monotonic timestamp.
+ * Returns whether the output ends at the start of a line.
+ */
+static int print_stamped(const char *buffer, size_t len, int at_line_start)
+{
+    struct timespec now;
+    const char *end = buffer + len;
+    const char *eol;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while (buffer < end) {
+        if (at_line_start)
+            printf("[%5ld.%06ld] ", (long)now.tv_sec, now.tv_nsec / 1000);
+        eol = memchr(buffer, '\n', end - buffer);
+        if (eol == NULL) {
+            fwrite(buffer, 1, end - buffer, stdout);
+            at_line_start = 0;
+            break;
+        }
+        fwrite(buffer, 1, eol + 1 - buffer, stdout);
+        buffer = eol + 1;
+        at_line_start = 1;
+    }
+    fflush(stdout);
+    return at_line_start;
+}
+
+/* Returns where the data already printed, ending with tail, ends in buffer[0..len).
+ * While the log grows the tail stays at offset. Once the log is full the driver
+ * drops the oldest messages and the tail moves towards the start, so it is searched
+ * backwards from there. Returns len + 1 if it is gone: the log was cleared or
+ * restarted, or more than a whole log was written since the previous poll.
+ */
+static size_t find_tail(const char *buffer, size_t len, size_t offset,
+                        const char *tail, size_t tail_len)
+{
+    size_t pos;
+
+    if (tail_len == 0 || len < tail_len)
+        return len + 1;
+    pos = offset - tail_len;
+    if (pos > len - tail_len)
+        pos = len - tail_len;
+    for (;;) {
+        if (buffer[pos] == tail[0] && memcmp(buffer + pos, tail, tail_len) == 0)
+            return pos + tail_len;
+        if (pos == 0)
+            return len + 1;
+        pos--;
+    }
+}
+
+/* Poll the DSP log and emit only what was added since the previous poll.
+ * The same buffer is reused for the whole session. The log length alone does
+ * not tell what is new once the log is full, so the end of what was printed
+ * is located by its last FOLLOW_TAIL_SIZE bytes.
+ */
+static int follow(int hifi_dsp_fd, struct misc_io_dump_buf_param *dump_buf,
+                  char *buffer, unsigned int interval_ms)
+{
+    struct timespec interval = {
+        .tv_sec = interval_ms / 1000,
+        .tv_nsec = (interval_ms % 1000) * 1000000L,
+    };
+    char tail[FOLLOW_TAIL_SIZE];
+    size_t tail_len = 0;
+    size_t offset = 0;
+    size_t len;
+    int at_line_start = 1;
+    int ret;
+
+    while (!stop) {
+        ret = ioctl(hifi_dsp_fd, HIFI_MISC_IOCTL_DISPLAY_MSG, dump_buf);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            ALOGE("Error %d accessing message buffer", errno);
+            return ret;
+        }
+        /* The ioctl returns the size of the message string copied, terminator
+         * included, so only its end is checked rather than the whole buffer.
+         */
+        len = (unsigned int)ret < dump_buf->buf_size ? (unsigned int)ret :
+              dump_buf->buf_size;
+        while (len > 0 && buffer[len - 1] == '\0')
+            len--;
+
+        if (dump_buf->clear) {
+            offset = 0;
+        } else {
+            offset = find_tail(buffer, len, offset, tail, tail_len);
+            if (offset > len) {
+                if (tail_len > 0) {
+                    if (!at_line_start)
+                        printf("\n");
+                    printf("--- log restarted or messages lost ---\n");
+                    at_line_start = 1;
+                }
+                tail_len = 0;
+                offset = 0;
+            }
+        }
+        if (len > offset) {
+            at_line_start = print_stamped(buffer + offset, len - offset, at_line_start);
+            tail_len = len < FOLLOW_TAIL_SIZE ? len : FOLLOW_TAIL_SIZE;
+            memcpy(tail, buffer + len - tail_len, tail_len);
+        }
+        offset = len;
+        nanosleep(&interval, NULL);
+    }
+    if (!at_line_start)
+        printf("\n");
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     char *buffer;
     int hifi_dsp_fd;
     int ret = -1;
-    int i = 0;
+    int opt;
+    int follow_mode = 0;
+    unsigned int interval_ms = FOLLOW_INTERVAL_MS;
     unsigned int memsize = DRV_DSP_UART_TO_MEM_SIZE;
     unsigned int clear = 0;
     struct misc_io_dump_buf_param dump_buf;
 
+    while ((opt = getopt(argc, argv, "fi:h")) != -1) {
+        switch (opt) {
+        case 'f':
+            follow_mode = 1;
+            break;
+        case 'i':
+            interval_ms = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return ret;
+        }
+    }
+
     ALOGI("Enter hifi-dsp Audio Framework - sample application\n");
-    if (argc > 1)
-        memsize = strtoul(argv[1], NULL, 0);
-    if (argc > 2)
+    if (argc > optind)
+        memsize = strtoul(argv[optind], NULL, 0);
+    if (argc > optind + 1)
         clear = 1;
     hifi_dsp_fd = open(HIFI_DSP_MISC_DRIVER, O_RDWR, 0);
     if (hifi_dsp_fd < 0) {
@@ -56,12 +208,19 @@ int main(int argc, char *argv[])
     dump_buf.user_buf = (uint64_t)buffer;
     dump_buf.buf_size = memsize;
     dump_buf.clear = clear;
+    if (follow_mode) {
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        ret = follow(hifi_dsp_fd, &dump_buf, buffer, interval_ms);
+        goto out1;
+    }
     ret = ioctl(hifi_dsp_fd, HIFI_MISC_IOCTL_DISPLAY_MSG, &dump_buf);
     if (ret < 0) { /* This IOCTL returns buffer size */
         ALOGE("Error %d accessing message buffer", errno);
     } else {
         printf("%s\n", ret > 0 ? buffer : "Buffer is empty");
     }
+out1:
     free(buffer);
 out0:
     close(hifi_dsp_fd);
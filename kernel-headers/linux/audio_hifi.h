@@ -14,6 +14,35 @@ struct misc_io_pcm_buf_param {
 	uint32_t buf_size;
 };
 
+/* misc_io_sync_param, misc_io_get_phys_param and xf_proxy_msg are laid out as
+ * in drivers/hisi/hifi_dsp/hifi_lpp.h of the hikey960 kernel
+ * (android-hikey-linaro-4.9), where 64-bit addresses are split into low and
+ * high words to keep the structures free of padding.
+ */
+struct misc_io_sync_param {
+	unsigned int para_in_l;		/* input buffer */
+	unsigned int para_in_h;
+	unsigned int para_size_in;
+	unsigned int para_out_l;	/* output buffer */
+	unsigned int para_out_h;
+	unsigned int para_size_out;
+};
+
+struct misc_io_get_phys_param {
+	unsigned int flag;
+	unsigned int phys_addr_l;	/* DSP side address of the mmap() region */
+	unsigned int phys_addr_h;
+};
+
+/* Xtensa Audio Framework proxy message */
+typedef struct xf_proxy_msg {
+	uint32_t id;		/* session/port identifier */
+	uint32_t opcode;
+	uint32_t length;	/* payload length */
+	uint64_t address;	/* payload address in the DSP shared memory */
+	uint64_t v_address;	/* payload address in the caller's mapping */
+} __attribute__((__packed__)) xf_proxy_msg_t;
+
 #define HIFI_DSP_MISC_DRIVER	"/dev/hifi_misc"
 
 #define HIFI_MISC_IOCTL_ASYNCMSG		_IOWR('A', 0x70, struct misc_io_async_param)
@@ -6,6 +6,8 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES:= uim.c
 
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/
+LOCAL_HEADER_LIBRARIES := android.hardware.bluetooth-bringup-trace-hikey
+LOCAL_SHARED_LIBRARIES := liblog
 
 LOCAL_MODULE_TAGS := eng
 
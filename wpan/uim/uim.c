@@ -25,13 +25,16 @@
 #include <poll.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
+#include <linux/netlink.h>
 
 #include <unistd.h>
 #include <time.h>
 
 #include "uim.h"
+#include "bt_bringup_trace.h"
 
 /* Maintains the exit state of UIM*/
 static int exiting;
@@ -42,6 +45,9 @@ static int dev_fd;
 char uim_bd_address[BD_ADDR_LEN];
 bdaddr_t *bd_addr;
 
+/* start of the current bring-up timeline, 0 when none is running */
+static int64_t timeline_start_ns;
+
 /* kim Sysfs path */
 static char *sysfs_install_entry = INSTALL_SYSFS_ENTRY;
 static char *sysfs_dev_name = DEV_NAME_SYSFS;
@@ -71,6 +77,62 @@ void read_firmware_version(int dev_fd)
 }
 #endif
 
+static int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Logs a bring-up phase with the time since the timeline started, and since
+ * boot, so the time to Bluetooth ready can be followed from the log. The
+ * phase also goes to the bring-up markers shared with the Bluetooth HAL.
+ */
+static void timeline_mark(const char *phase)
+{
+	int64_t now = bt_bringup_mark("uim", phase);
+
+	if (timeline_start_ns == 0)
+		timeline_start_ns = now;
+	UIM_ERR("timeline: %-24s +%4lld.%03lld ms (%lld ms since boot)", phase,
+		(long long)((now - timeline_start_ns) / NSEC_PER_MSEC),
+		(long long)((now - timeline_start_ns) % NSEC_PER_MSEC / 1000),
+		(long long)(now / NSEC_PER_MSEC));
+}
+
+/* Milliseconds left until deadline, for poll() */
+static int ms_until(int64_t deadline_ns)
+{
+	int64_t left = deadline_ns - monotonic_ns();
+
+	if (left <= 0)
+		return 0;
+	return (int)((left + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC);
+}
+
+/* Reads exactly len bytes, waiting in poll() for at most until deadline_ns */
+static int read_until(int fd, unsigned char *buf, int len, int64_t deadline_ns)
+{
+	struct pollfd p = { .fd = fd, .events = POLLIN };
+	int count = 0, rd, ret;
+
+	while (count < len) {
+		ret = poll(&p, 1, ms_until(deadline_ns));
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		rd = read(fd, buf + count, len - count);
+		if (rd < 0 && (errno == EAGAIN || errno == EINTR))
+			continue;
+		if (rd <= 0)
+			return -1;
+		count += rd;
+	}
+	return count;
+}
+
 void sysfs_entry_fallback(void)
 {
 	sysfs_install_entry = INSTALL_SYSFS_ENTRY_OLD;
@@ -87,11 +149,8 @@ void sysfs_entry_fallback(void)
  */
 int read_hci_event(int fd, unsigned char *buf, int size)
 {
-	int remain, rd;
-	int count = 0;
-	int reading = 1;
-	int rd_retry_count = 0;
-	struct timespec tm = {0, 50*1000*1000};
+	int remain;
+	int64_t deadline = monotonic_ns() + HCI_EVENT_TIMEOUT_MS * NSEC_PER_MSEC;
 
 	UIM_START_FUNC();
 
@@ -101,28 +160,14 @@ int read_hci_event(int fd, unsigned char *buf, int size)
 
 	/* The first byte identifies the packet type. For HCI event packets, it
 	 * should be 0x04, so we read until we get to the 0x04. */
-	while (reading) {
-		rd = read(fd, buf, 1);
-		if (rd <= 0 && rd_retry_count++ < 4) {
-			nanosleep(&tm, NULL);
-			continue;
-		} else if (rd_retry_count >= 4) {
+	do {
+		if (read_until(fd, buf, 1, deadline) < 0)
 			return -1;
-		}
-
-		if (buf[0] == RESP_PREFIX) {
-			break;
-		}
-	}
-	count++;
+	} while (buf[0] != RESP_PREFIX);
 
 	/* The next two bytes are the event code and parameter total length. */
-	while (count < 3) {
-		rd = read(fd, buf + count, 3 - count);
-		if (rd <= 0)
-			return -1;
-		count += rd;
-	}
+	if (read_until(fd, buf + 1, 2, deadline) < 0)
+		return -1;
 
 	/* Now we read the parameters. */
 	if (buf[2] < (size - 3))
@@ -130,14 +175,10 @@ int read_hci_event(int fd, unsigned char *buf, int size)
 	else
 		remain = size - 3;
 
-	while ((count - 3) < remain) {
-		rd = read(fd, buf + count, remain - (count - 3));
-		if (rd <= 0)
-			return -1;
-		count += rd;
-	}
+	if (remain > 0 && read_until(fd, buf + 3, remain, deadline) < 0)
+		return -1;
 
-	return count;
+	return 3 + remain;
 }
 
 /* Function to read the Command complete event
@@ -296,6 +337,8 @@ int st_uart_config(unsigned char install)
 	UIM_START_FUNC();
 
 	if (install == '1') {
+		timeline_start_ns = 0;
+		timeline_mark("install requested");
 		memset(buf, 0, UART_DEV_NAME_LEN);
 		fd = open(sysfs_dev_name, O_RDONLY);
 		if (fd < 0) {
@@ -349,6 +392,7 @@ int st_uart_config(unsigned char install)
 			UIM_ERR("Can't open %s", uart_dev_name);
 			return -1;
 		}
+		timeline_mark("uart opened");
 
 		/*
 		 * Set only the default baud rate.
@@ -387,6 +431,7 @@ int st_uart_config(unsigned char install)
 				close(dev_fd);
 				return -1;
 			}
+			timeline_mark("controller speed set");
 
 			UIM_VER("Speed changing to %d, %d", cust_baud_rate, flow_ctrl);
 			/* Set the actual custom baud rate at the host side */
@@ -395,6 +440,7 @@ int st_uart_config(unsigned char install)
 				close(dev_fd);
 				return -1;
 			}
+			timeline_mark("host speed set");
 
 			/* Set the uim BD address */
 			if (uim_bd_address[0] != 0) {
@@ -423,6 +469,7 @@ int st_uart_config(unsigned char install)
 					return -1;
 				}
 				UIM_VER("BD address changed to %s", uim_bd_address);
+				timeline_mark("bd address set");
 			}
 #ifdef UIM_DEBUG
 			read_firmware_version(dev_fd);
@@ -439,12 +486,14 @@ int st_uart_config(unsigned char install)
 			return -1;
 		}
 		UIM_DBG("Installed N_TI_WL Line displine");
+		timeline_mark("line discipline installed");
 	}
 	else {
 		UIM_DBG("Un-Installed N_TI_WL Line displine");
 		/* UNINSTALL_N_TI_WL - When the Signal is received from KIM */
 		/* closing UART fd */
 		close(dev_fd);
+		timeline_mark("uninstalled");
 	}
 	return 0;
 }
@@ -469,16 +518,85 @@ bdaddr_t *strtoba(const char *str)
         return (bdaddr_t *) ba;
 }
 
+/* Opens the netlink socket the kernel sends device uevents to */
+static int open_uevent_socket(void)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int open_install_entry(void)
+{
+	int fd = open(INSTALL_SYSFS_ENTRY, O_RDONLY);
+
+	if (fd >= 0)
+		return fd;
+	fd = open(INSTALL_SYSFS_ENTRY_OLD, O_RDONLY);
+	if (fd >= 0)
+		sysfs_entry_fallback();
+	return fd;
+}
+
+/* The sysfs entry may get populated after the service is started. Rather than
+ * sleeping between retries, wait for the kernel to announce a device and look
+ * again, until the deadline. Without a uevent socket, look every
+ * SYSFS_RETRY_MS.
+ */
+static int wait_install_entry(void)
+{
+	int64_t deadline = monotonic_ns() + SYSFS_WAIT_MS * NSEC_PER_MSEC;
+	char uevent[UEVENT_MSG_LEN];
+	struct pollfd p;
+	int fd, timeout;
+
+	fd = open_install_entry();
+	if (fd >= 0)
+		return fd;
+
+	p.fd = open_uevent_socket();
+	p.events = POLLIN;
+	/* an entry added while the socket was being set up has no uevent left */
+	fd = open_install_entry();
+
+	while (fd < 0 && ms_until(deadline) > 0) {
+		timeout = ms_until(deadline);
+		if (p.fd < 0 && timeout > SYSFS_RETRY_MS)
+			timeout = SYSFS_RETRY_MS;
+		if (poll(&p, p.fd < 0 ? 0 : 1, timeout) > 0)
+			while (recv(p.fd, uevent, sizeof(uevent), 0) > 0)
+				;
+		fd = open_install_entry();
+	}
+
+	if (p.fd >= 0)
+		close(p.fd);
+	return fd;
+}
+
 /*****************************************************************************/
 int main(int argc, char *argv[])
 {
-	int st_fd, err,trials;
+	int st_fd, err;
 	unsigned char install;
 	struct pollfd 	p;
 
 	UIM_START_FUNC();
+	timeline_mark("started");
 	err = 0;
-	trials = 5;
 
 	/* Parse the user input */
 	if ((argc > 2)) {
@@ -487,32 +605,23 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 	if (argc == 2) {
-		if (strlen(argv[2]) != BD_ADDR_LEN) {
+		if (strlen(argv[1]) != BD_ADDR_LEN) {
 			UIM_ERR("Usage: uim XX:XX:XX:XX:XX:XX");
 			return -1;
 		}
 		/* BD address passed as string in xx:xx:xx:xx:xx:xx format */
-		strncpy(uim_bd_address, argv[2], sizeof(uim_bd_address));
+		strncpy(uim_bd_address, argv[1], sizeof(uim_bd_address));
 		bd_addr = strtoba(uim_bd_address);
 	}
 
 	line_discipline = N_TI_WL;
 
-	/* sysfs entry may get populated after service is started so we retry if it fails*/
-	while (trials > 0) {
-		st_fd = open(sysfs_install_entry, O_RDONLY);
-		if(st_fd > 0)
-			break;
-		if (trials == 3)
-			sysfs_entry_fallback();
-		else
-			usleep(500000);
-		--trials;
-		}
+	st_fd = wait_install_entry();
 	if (st_fd < 0) {
 		UIM_DBG("unable to open %s(%s)", sysfs_install_entry, strerror(errno));
 		return -1;
 	}
+	timeline_mark("sysfs entry found");
 
 RE_POLL:
 	/* read to start proper poll */
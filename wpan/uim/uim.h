@@ -40,6 +40,8 @@
 #define WRITE_BD_ADDR_OPCODE    0xFC06
 #define RESP_PREFIX		0x04
 #define MAX_TRY			10
+/* how long a command may take to complete */
+#define HCI_EVENT_TIMEOUT_MS	200
 
 /* HCI Packet types */
 #define HCI_COMMAND_PKT		0x01
@@ -74,6 +76,15 @@
 #define BAUD_RATE_SYSFS_OLD "/sys/devices/kim/baud_rate"
 #define FLOW_CTRL_SYSFS_OLD "/sys/devices/kim/flow_cntrl"
 
+/* how long to wait for the sysfs entries to show up at start */
+#define SYSFS_WAIT_MS		2500
+/* how often to look for them when uevents can't be received */
+#define SYSFS_RETRY_MS		100
+#define UEVENT_MSG_LEN		2048
+
+#define NSEC_PER_SEC		1000000000LL
+#define NSEC_PER_MSEC		1000000LL
+
 #define VERBOSE
 /*Debug logs*/
 #define UIM_ERR(fmt, arg...)  printf("uim:"fmt"\n" , ##arg)